@@ -61,6 +61,167 @@
 static const struct gsu_hash mapfiles_gsu =
 { hashgetfn, setpmmapfiles, stdunsetfn };
 
+/*
+ * Cache of file contents.  Rather than copying a file each time it
+ * is referenced, we keep the mapping around and revalidate it against
+ * the file's identity when it's next used.  Values are only metafied
+ * at the point a parameter value (or a slice of one, via zmapfile) is
+ * actually wanted.
+ */
+
+typedef struct mapfent *Mapfent;
+
+struct mapfent {
+    Mapfent next;
+    char *name;			/* unmetafied name of the file */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    char *addr;			/* contents, not metafied; NULL if empty */
+};
+
+/* Maximum number of files we keep mapped at once */
+
+#define MAPFILE_MAXMAPS	8
+
+static Mapfent mapfents;
+
+static void
+freemapfent(Mapfent m)
+{
+    if (m->addr) {
+#ifdef USE_MMAP
+	munmap((caddr_t)m->addr, m->size);
+#else
+	zfree(m->addr, m->size);
+#endif
+    }
+    zsfree(m->name);
+    zfree(m, sizeof(struct mapfent));
+}
+
+/* Forget any contents cached for the file with unmetafied name uname. */
+
+/**/
+static void
+dropmapping(char *uname)
+{
+    Mapfent m, *mp;
+
+    for (mp = &mapfents; (m = *mp); mp = &m->next) {
+	if (!strcmp(m->name, uname)) {
+	    *mp = m->next;
+	    freemapfent(m);
+	    return;
+	}
+    }
+}
+
+/*
+ * Return the contents of the file with unmetafied name uname, using
+ * the cached copy if the file hasn't changed since it was made.
+ * Returns NULL with errno set if the file can't be read.
+ */
+
+static Mapfent
+getmapping(char *uname)
+{
+    Mapfent m, *mp;
+    struct stat sbuf;
+    int fd, n;
+#ifndef USE_MMAP
+    off_t got;
+#endif
+
+    if (stat(uname, &sbuf) < 0) {
+	int err = errno;
+	dropmapping(uname);
+	errno = err;
+	return NULL;
+    }
+    for (mp = &mapfents; (m = *mp); mp = &m->next) {
+	if (!strcmp(m->name, uname)) {
+	    *mp = m->next;
+	    if (m->dev == sbuf.st_dev && m->ino == sbuf.st_ino &&
+		m->size == sbuf.st_size && m->mtime == sbuf.st_mtime) {
+		/* still valid: move to the front */
+		m->next = mapfents;
+		mapfents = m;
+		return m;
+	    }
+	    freemapfent(m);
+	    break;
+	}
+    }
+
+    if ((fd = open(uname, O_RDONLY | O_NOCTTY)) < 0)
+	return NULL;
+    if (fstat(fd, &sbuf) < 0) {
+	int err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+    }
+    m = (Mapfent) zshcalloc(sizeof(struct mapfent));
+    m->dev = sbuf.st_dev;
+    m->ino = sbuf.st_ino;
+    m->size = sbuf.st_size;
+    m->mtime = sbuf.st_mtime;
+    if (m->size) {
+#ifdef USE_MMAP
+	caddr_t mmptr = (caddr_t)mmap((caddr_t)0, m->size, PROT_READ,
+				      MMAP_ARGS, fd, (off_t)0);
+	if (mmptr == (caddr_t)-1) {
+	    int err = errno;
+	    close(fd);
+	    zfree(m, sizeof(struct mapfent));
+	    errno = err;
+	    return NULL;
+	}
+	m->addr = (char *)mmptr;
+#else /* don't USE_MMAP */
+	m->addr = (char *)zalloc(m->size);
+	for (got = 0; got < m->size; got += n) {
+	    if ((n = read(fd, m->addr + got, m->size - got)) <= 0) {
+		if (n < 0 && errno == EINTR) {
+		    n = 0;
+		    continue;
+		}
+		break;
+	    }
+	}
+	if (got < m->size) {
+	    int err = errno;
+	    close(fd);
+	    zfree(m->addr, m->size);
+	    zfree(m, sizeof(struct mapfent));
+	    errno = err;
+	    return NULL;
+	}
+#endif /* USE_MMAP */
+    }
+    close(fd);
+    m->name = ztrdup(uname);
+
+    /* Add at the front, discarding the least recently used if full */
+    m->next = mapfents;
+    mapfents = m;
+    for (n = 1, mp = &m->next; *mp; mp = &(*mp)->next, n++) {
+	if (n == MAPFILE_MAXMAPS) {
+	    Mapfent old = *mp;
+	    *mp = NULL;
+	    while (old) {
+		Mapfent next = old->next;
+		freemapfent(old);
+		old = next;
+	    }
+	    break;
+	}
+    }
+    return m;
+}
+
 /* Functions for the options special parameter. */
 
 /**/
@@ -81,6 +242,7 @@ setpmmapfile(Param pm, char *value)
      */
     unmetafy(name, &len);
     unmetafy(value, &len);
+    dropmapping(name);
 
     /* Open the file for writing */
 #ifdef USE_MMAP
@@ -130,8 +292,10 @@ unsetpmmapfile(Param pm, UNUSED(int exp))
     int dummy;
     unmetafy(fname, &dummy);
 
-    if (!(pm->node.flags & PM_READONLY))
+    if (!(pm->node.flags & PM_READONLY)) {
+	dropmapping(fname);
 	unlink(fname);
+    }
 
     free(fname);
 }
@@ -161,53 +325,33 @@ setpmmapfiles(Param pm, HashTable ht)
     deleteparamtable(ht);
 }
 
+/*
+ * Get the value of an element.  The contents are metafied here,
+ * on demand, rather than when the element is looked up, so that
+ * tests such as ${+mapfile[name]} don't need to copy the file.
+ */
+
 /**/
 static char *
-get_contents(char *fname)
+getpmmapfilestr(Param pm)
 {
-    int fd;
-#ifdef USE_MMAP
-    caddr_t mmptr;
-    struct stat sbuf;
-#endif
-    char *val;
-    unmetafy(fname = ztrdup(fname), &fd);
-
-#ifdef USE_MMAP
-    if ((fd = open(fname, O_RDONLY | O_NOCTTY)) < 0 ||
-	fstat(fd, &sbuf) ||
-	(mmptr = (caddr_t)mmap((caddr_t)0, sbuf.st_size, PROT_READ,
-			       MMAP_ARGS, fd, (off_t)0)) == (caddr_t)-1) {
-	if (fd >= 0)
-	    close(fd);
-	free(fname);
-	return NULL;
-    }
+    Mapfent m;
 
-    /*
-     * Sadly, we need to copy the thing even if metafying doesn't
-     * change it.  We just don't know when we might get a chance to
-     * munmap it, otherwise.
-     */
-    val = metafy((char *)mmptr, sbuf.st_size, META_HEAPDUP);
-
-    munmap(mmptr, sbuf.st_size);
-    close(fd);
-#else /* don't USE_MMAP */
-    val = NULL;
-    if ((fd = open(fname, O_RDONLY | O_NOCTTY)) >= 0) {
-	LinkList ll;
-
-	if ((ll = readoutput(fd, 1)))
-	    val = peekfirst(ll);
+    if (!pm->u.str) {
+	if ((m = getmapping(unmeta(pm->node.nam))) && m->size)
+	    pm->u.str = metafy(m->addr, m->size, META_HEAPDUP);
+	else
+	    pm->u.str = "";
     }
-#endif /* USE_MMAP */
-    free(fname);
-    return val;
+    return pm->u.str;
 }
 
 static const struct gsu_scalar mapfile_gsu =
-{ strgetfn, setpmmapfile, unsetpmmapfile };
+{ getpmmapfilestr, setpmmapfile, unsetpmmapfile };
+
+static struct builtin bintab[] = {
+    BUILTIN("zmapfile", 0, bin_zmapfile, 1, 2, 0, "bc:l:m:o:", NULL),
+};
 
 static struct paramdef partab[] = {
     SPECIALPMDEF("mapfile", 0, &mapfiles_gsu, getpmmapfile, scanpmmapfile)
@@ -217,7 +361,7 @@ static struct paramdef partab[] = {
 static HashNode
 getpmmapfile(UNUSED(HashTable ht), const char *name)
 {
-    char *contents;
+    Mapfent m;
     Param pm = NULL;
 
     pm = (Param) hcalloc(sizeof(struct param));
@@ -226,10 +370,12 @@ getpmmapfile(UNUSED(HashTable ht), const char *name)
     pm->gsu.s = &mapfile_gsu;
     pm->node.flags |= (partab[0].pm->node.flags & PM_READONLY);
 
-    /* Set u.str to contents of file given by name */
-    if ((contents = get_contents(pm->node.nam)))
-	pm->u.str = contents;
-    else {
+    /*
+     * Make sure the file is readable; the contents are retrieved
+     * by getpmmapfilestr() when needed.  As an empty file can't be
+     * mapped, it's always been treated as unset.
+     */
+    if (!(m = getmapping(unmeta(pm->node.nam))) || !m->size) {
 	pm->u.str = "";
 	pm->node.flags |= PM_UNSET;
     }
@@ -267,8 +413,127 @@ scanpmmapfile(UNUSED(HashTable ht), ScanFunc func, int flags)
     closedir(dir);
 }
 
+/**/
+static int
+getmapoffset(char *instr, char *nam, zlong *ret)
+{
+    char *eptr;
+
+    *ret = zstrtol(instr, &eptr, 10);
+    if (*eptr || *ret < 0) {
+	zwarnnam(nam, "integer expected: %s", instr);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * zmapfile [ -o offset ] [ -l length ] file [ param ]
+ * zmapfile -m pattern [ -b ] [ -c count ] [ -o offset ] [ -l length ]
+ *          file [ param ]
+ *
+ * Extract part of a file, or the lines in it that match a pattern,
+ * working directly on the mapped contents.  Only the text actually
+ * returned is copied and metafied.
+ */
+
+/**/
+static int
+bin_zmapfile(char *nam, char **args, Options ops, UNUSED(int func))
+{
+    Mapfent m;
+    Patprog prog = NULL;
+    zlong off = 0, len = -1, count = -1;
+    char *start, *end;
+
+    if ((OPT_ISSET(ops,'o') &&
+	 getmapoffset(OPT_ARG(ops,'o'), nam, &off)) ||
+	(OPT_ISSET(ops,'l') &&
+	 getmapoffset(OPT_ARG(ops,'l'), nam, &len)) ||
+	(OPT_ISSET(ops,'c') &&
+	 getmapoffset(OPT_ARG(ops,'c'), nam, &count)))
+	return 1;
+    if (OPT_ISSET(ops,'m')) {
+	char *p = dupstring(OPT_ARG(ops,'m'));
+
+	tokenize(p);
+	remnulargs(p);
+	if (!(prog = patcompile(p, 0, NULL))) {
+	    zwarnnam(nam, "bad pattern: %s", OPT_ARG(ops,'m'));
+	    return 1;
+	}
+    } else if (OPT_ISSET(ops,'b') || OPT_ISSET(ops,'c')) {
+	zwarnnam(nam, "-%c requires -m", OPT_ISSET(ops,'b') ? 'b' : 'c');
+	return 1;
+    }
+    if (args[1] && !isident(args[1])) {
+	zwarnnam(nam, "not an identifier: %s", args[1]);
+	return 1;
+    }
+
+    if (!(m = getmapping(unmeta(args[0])))) {
+	zwarnnam(nam, "%e: %s", errno, args[0]);
+	return 1;
+    }
+    if (off > (zlong)m->size)
+	off = m->size;
+    if (len < 0 || len > (zlong)m->size - off)
+	len = m->size - off;
+    start = m->addr + off;
+    end = start + len;
+
+    if (!prog) {
+	if (len > INT_MAX) {
+	    zwarnnam(nam, "slice too long: %s", args[0]);
+	    return 1;
+	}
+	setsparam(args[1] ? args[1] : "REPLY",
+		  len ? metafy(start, (int)len, META_DUP) : ztrdup(""));
+    } else {
+	LinkList matches = newlinklist();
+	struct patstralloc patstralloc;
+
+	/*
+	 * The contents are passed to the pattern code as if
+	 * already unmetafied, so lines are matched in place.
+	 */
+	memset(&patstralloc, 0, sizeof(patstralloc));
+	while (start < end && count && !errflag) {
+	    char *eol = memchr(start, '\n', end - start), *next;
+
+	    if (eol)
+		next = eol + 1;
+	    else
+		eol = next = end;
+	    if (eol - start <= INT_MAX) {
+		patstralloc.alloced = start;
+		patstralloc.unmetalen = (int)(eol - start);
+		if (pattrylen(prog, start, (int)(eol - start), 0,
+			      &patstralloc, 0)) {
+		    if (OPT_ISSET(ops,'b')) {
+			char buf[DIGBUFSIZE];
+
+			convbase(buf, (zlong)(start - m->addr), 10);
+			addlinknode(matches, dupstring(buf));
+		    } else
+			addlinknode(matches,
+				    metafy(start, (int)(eol - start),
+					   META_HEAPDUP));
+		    if (count > 0)
+			count--;
+		}
+	    }
+	    start = next;
+	}
+	if (errflag)
+	    return 1;
+	setaparam(args[1] ? args[1] : "reply", zlinklist2array(matches));
+    }
+    return 0;
+}
+
 static struct features module_features = {
-    NULL, 0,
+    bintab, sizeof(bintab)/sizeof(*bintab),
     NULL, 0,
     NULL, 0,
     partab, sizeof(partab)/sizeof(*partab),
@@ -315,5 +580,10 @@ cleanup_(Module m)
 int
 finish_(UNUSED(Module m))
 {
+    while (mapfents) {
+	Mapfent next = mapfents->next;
+	freemapfent(mapfents);
+	mapfents = next;
+    }
     return 0;
 }
@@ -39,6 +39,20 @@
 
 #define SYSREAD_BUFSIZE	8192
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_MUNMAP)
+# define USE_MMAP 1
+# include <sys/mman.h>
+#endif
+
+/* Default buffer size for sysreadlines */
+#define SYSREADLINES_BUFSIZE	65536
+
+/*
+ * Size of the first read for a single line from a file, which has to
+ * seek back over whatever follows the line.
+ */
+#define SYSREADLINES_FIRSTREAD	256
+
 /**/
 static int
 getposint(char *instr, char *nam)
@@ -227,6 +241,333 @@ bin_sysread(char *nam, char **args, Options ops, UNUSED(int func))
 }
 
 
+/*
+ * Input source for sysreadlines.  Unconsumed input is buf[pos] to
+ * buf[len - 1]; for a mapped file that is the whole of the rest of
+ * the file.
+ */
+
+struct linesrc {
+    int fd;
+    char *buf;
+    size_t size;		/* allocated size of buf, if not mapped */
+    size_t pos, len;
+    size_t scanned;		/* buf[pos..scanned) has no delimiter */
+    size_t chunk;		/* most to ask for in the next read */
+    int eof;
+    int mapped;
+};
+
+/*
+ * Input read from a pipe or terminal beyond the end of the lines
+ * returned can't be pushed back, so is kept here for the next
+ * sysreadlines on the same file descriptor.  The device and inode
+ * are recorded so that it's not used if the descriptor has since
+ * been redirected elsewhere.
+ */
+
+typedef struct linebuf *Linebuf;
+
+struct linebuf {
+    Linebuf next;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    char *buf;
+    size_t size, len;
+};
+
+static Linebuf linebufs;
+
+static void
+linesrc_init(struct linesrc *src, int fd, size_t bufsize, int usemmap,
+	     int oneline)
+{
+    Linebuf lb, *lbp;
+    struct stat sbuf;
+    int statok;
+
+    memset(src, 0, sizeof(*src));
+    src->fd = fd;
+    statok = !fstat(fd, &sbuf);
+#ifdef USE_MMAP
+    if (usemmap) {
+	off_t cur;
+	caddr_t mmptr;
+
+	if (statok && S_ISREG(sbuf.st_mode) && sbuf.st_size &&
+	    (cur = lseek(fd, 0, SEEK_CUR)) >= 0 &&
+	    (mmptr = (caddr_t)mmap((caddr_t)0, sbuf.st_size, PROT_READ,
+				   MAP_SHARED, fd, (off_t)0)) !=
+	    (caddr_t)-1) {
+	    src->buf = (char *)mmptr;
+	    src->size = sbuf.st_size;
+	    src->pos = src->scanned = (cur > sbuf.st_size) ?
+		sbuf.st_size : cur;
+	    src->len = sbuf.st_size;
+	    src->eof = src->mapped = 1;
+	    return;
+	}
+    }
+#endif
+    for (lbp = &linebufs; (lb = *lbp); lbp = &lb->next) {
+	if (lb->fd == fd) {
+	    *lbp = lb->next;
+	    if (statok && lb->dev == sbuf.st_dev && lb->ino == sbuf.st_ino) {
+		src->buf = lb->buf;
+		src->size = lb->size;
+		src->len = lb->len;
+	    } else
+		zfree(lb->buf, lb->size);
+	    zfree(lb, sizeof(*lb));
+	    break;
+	}
+    }
+    if (src->size < bufsize) {
+	src->buf = zrealloc(src->buf, bufsize);
+	src->size = bufsize;
+    }
+    /*
+     * When reading just one line from a file, start small so as not to
+     * read and seek back over much more than the line; the reads
+     * double in size for longer lines.
+     */
+    if (oneline && statok && S_ISREG(sbuf.st_mode) &&
+	bufsize > SYSREADLINES_FIRSTREAD)
+	src->chunk = SYSREADLINES_FIRSTREAD;
+    else
+	src->chunk = bufsize;
+}
+
+/*
+ * Finished with input: give back anything we didn't use, either by
+ * seeking back or by keeping it for next time.
+ */
+
+static void
+linesrc_finish(struct linesrc *src, int keep)
+{
+    struct stat sbuf;
+
+#ifdef USE_MMAP
+    if (src->mapped) {
+	if (keep)
+	    lseek(src->fd, (off_t)src->pos, SEEK_SET);
+	munmap((caddr_t)src->buf, src->size);
+	return;
+    }
+#endif
+    if (keep && src->pos < src->len &&
+	lseek(src->fd, -(off_t)(src->len - src->pos), SEEK_CUR) < 0 &&
+	!fstat(src->fd, &sbuf)) {
+	Linebuf lb = (Linebuf)zalloc(sizeof(*lb));
+
+	if (src->pos)
+	    memmove(src->buf, src->buf + src->pos, src->len - src->pos);
+	lb->fd = src->fd;
+	lb->dev = sbuf.st_dev;
+	lb->ino = sbuf.st_ino;
+	lb->buf = src->buf;
+	lb->size = src->size;
+	lb->len = src->len - src->pos;
+	lb->next = linebufs;
+	linebufs = lb;
+	return;
+    }
+    zfree(src->buf, src->size);
+}
+
+/*
+ * Get the next line, without the delimiter.  Returns 1 if there was
+ * one, 0 at end of file, -1 on a read error.
+ */
+
+static int
+linesrc_next(struct linesrc *src, int delim, char **linep, size_t *lenp)
+{
+    for (;;) {
+	char *eol = memchr(src->buf + src->scanned, delim,
+			   src->len - src->scanned);
+	ssize_t count;
+	size_t want;
+
+	if (eol) {
+	    *linep = src->buf + src->pos;
+	    *lenp = eol - *linep;
+	    src->pos = src->scanned = eol + 1 - src->buf;
+	    return 1;
+	}
+	if (src->eof) {
+	    if (src->pos == src->len)
+		return 0;
+	    *linep = src->buf + src->pos;
+	    *lenp = src->len - src->pos;
+	    src->pos = src->scanned = src->len;
+	    return 1;
+	}
+	if (src->pos) {
+	    memmove(src->buf, src->buf + src->pos, src->len - src->pos);
+	    src->len -= src->pos;
+	    src->pos = 0;
+	}
+	src->scanned = src->len;
+	if (src->len == src->size) {
+	    /* a line longer than the buffer */
+	    src->buf = zrealloc(src->buf, src->size * 2);
+	    src->size *= 2;
+	}
+	want = src->size - src->len;
+	if (want > src->chunk)
+	    want = src->chunk;
+	while ((count = read(src->fd, src->buf + src->len, want)) < 0) {
+	    if (errno != EINTR || errflag || retflag || breaks || contflag)
+		return -1;
+	}
+	if (src->chunk < src->size)
+	    src->chunk *= 2;
+	if (count)
+	    src->len += count;
+	else
+	    src->eof = 1;
+    }
+}
+
+/*
+ * Return values of bin_sysreadlines:
+ *	0	At least one line was read; with -c, the status of
+ *		the last execution of the body
+ *	1	Error in parameters to command
+ *	2	Error on read, ERRNO set by system
+ *	5	No lines read, end of file
+ */
+
+/**/
+static int
+bin_sysreadlines(char *nam, char **args, Options ops, UNUSED(int func))
+{
+    int fd = 0, delim = '\n', bufsize = SYSREADLINES_BUFSIZE;
+    int batch = 0, ret = 0, status = 0, got;
+    char *outvar, *fname = NULL;
+    Eprog prog = NULL;
+    struct linesrc src;
+
+    if (OPT_ISSET(ops, 'i')) {
+	if (OPT_ISSET(ops, 'f')) {
+	    zwarnnam(nam, "-i and -f are mutually exclusive");
+	    return 1;
+	}
+	fd = getposint(OPT_ARG(ops, 'i'), nam);
+	if (fd < 0)
+	    return 1;
+    } else if (OPT_ISSET(ops, 'f'))
+	fname = OPT_ARG(ops, 'f');
+
+    /* -d: delimiter, the first character of the argument */
+    if (OPT_ISSET(ops, 'd')) {
+	char *d = OPT_ARG(ops, 'd');
+
+	delim = (unsigned char)((*d == Meta) ? d[1] ^ 32 : *d);
+    }
+
+    /* -n: maximum number of lines per array assignment */
+    if (OPT_ISSET(ops, 'n')) {
+	batch = getposint(OPT_ARG(ops, 'n'), nam);
+	if (batch < 0)
+	    return 1;
+	if (!batch) {
+	    zwarnnam(nam, "line count must be positive");
+	    return 1;
+	}
+    }
+
+    if (OPT_ISSET(ops, 's')) {
+	bufsize = getposint(OPT_ARG(ops, 's'), nam);
+	if (bufsize < 0)
+	    return 1;
+	if (!bufsize)
+	    bufsize = SYSREAD_BUFSIZE;
+    }
+
+    if (*args) {
+	outvar = *args;
+	if (!isident(outvar)) {
+	    zwarnnam(nam, "not an identifier: %s", outvar);
+	    return 1;
+	}
+    } else
+	outvar = batch ? "reply" : "REPLY";
+
+    if (OPT_ISSET(ops, 'c')) {
+	if (!(prog = parse_string(OPT_ARG(ops, 'c'), 0)))
+	    return 1;
+	prog = dupeprog(prog, 0);
+    }
+
+    if (fname && (fd = open(unmeta(fname), O_RDONLY | O_NOCTTY)) < 0) {
+	if (prog)
+	    freeeprog(prog);
+	return 2;
+    }
+    linesrc_init(&src, fd, bufsize, OPT_ISSET(ops, 'm'), !prog && !batch);
+
+    if (prog)
+	loops++;
+    pushheap();
+    do {
+	char *line;
+	size_t len;
+
+	if (batch) {
+	    LinkList linelist = newlinklist();
+
+	    for (got = 0; got < batch; got++) {
+		if ((ret = linesrc_next(&src, delim, &line, &len)) <= 0)
+		    break;
+		addlinknode(linelist, metafy(line, len, META_HEAPDUP));
+	    }
+	    if (got)
+		setaparam(outvar, zlinklist2array(linelist));
+	} else {
+	    if ((got = ((ret = linesrc_next(&src, delim,
+					    &line, &len)) > 0)))
+		setsparam(outvar, metafy(line, len, META_DUP));
+	}
+	if (ret < 0 || errflag) {
+	    ret = 2;
+	    break;
+	}
+	if (!got) {
+	    ret = prog ? status : 5;
+	    break;
+	}
+	if (!prog) {
+	    ret = 0;
+	    break;
+	}
+	execode(prog, 1, 0, "sysreadlines");
+	ret = status = lastval;
+	freeheap();
+	if (breaks) {
+	    breaks--;
+	    if (breaks || !contflag)
+		break;
+	    contflag = 0;
+	}
+    } while (!retflag && !errflag);
+    popheap();
+    if (prog) {
+	loops--;
+	freeeprog(prog);
+    }
+
+    linesrc_finish(&src, !fname);
+    if (fname)
+	close(fd);
+
+    return ret;
+}
+
+
 /*
  * Return values of bin_syswrite:
  *	0	Successfully written
@@ -717,6 +1058,7 @@ bin_zsystem(char *nam, char **args, Options ops, int func)
 static struct builtin bintab[] = {
     BUILTIN("syserror", 0, bin_syserror, 0, 1, 0, "e:p:", NULL),
     BUILTIN("sysread", 0, bin_sysread, 0, 1, 0, "c:i:o:s:t:", NULL),
+    BUILTIN("sysreadlines", 0, bin_sysreadlines, 0, 1, 0, "c:d:f:i:mn:s:", NULL),
     BUILTIN("syswrite", 0, bin_syswrite, 1, 1, 0, "c:o:", NULL),
     BUILTIN("sysopen", 0, bin_sysopen, 1, 1, 0, "rwau:o:m:", NULL),
     BUILTIN("sysseek", 0, bin_sysseek, 1, 1, 0, "u:w:", NULL),
@@ -851,5 +1193,11 @@ cleanup_(Module m)
 int
 finish_(UNUSED(Module m))
 {
+    while (linebufs) {
+	Linebuf next = linebufs->next;
+	zfree(linebufs->buf, linebufs->size);
+	zfree(linebufs, sizeof(*linebufs));
+	linebufs = next;
+    }
     return 0;
 }
@@ -210,6 +210,40 @@ freehostent(UNUSED(struct hostent *ptr))
 
 static LinkList ztcp_sessions;
 
+/*
+ * Sessions indexed by file descriptor, so that they can be found
+ * without searching the list.  Callers such as zftp may change the
+ * fd of a session themselves, so an entry is only trusted if it
+ * matches; zts_byfd() searches the list if not.
+ */
+static Tcp_session *ztcp_fdtab;
+static int ztcp_fdtabsize;
+
+/* Record sess in the index under its current fd */
+static void
+zts_index(Tcp_session sess)
+{
+    if (sess->ifd >= 0 && sess->ifd < ztcp_fdtabsize &&
+	ztcp_fdtab[sess->ifd] == sess)
+	ztcp_fdtab[sess->ifd] = NULL;
+    sess->ifd = -1;
+    if (sess->fd < 0)
+	return;
+    if (sess->fd >= ztcp_fdtabsize) {
+	int newsize = ztcp_fdtabsize ? ztcp_fdtabsize : 16;
+
+	while (newsize <= sess->fd)
+	    newsize *= 2;
+	ztcp_fdtab = (Tcp_session *)zrealloc(ztcp_fdtab,
+					     newsize * sizeof(Tcp_session));
+	memset(ztcp_fdtab + ztcp_fdtabsize, 0,
+	       (newsize - ztcp_fdtabsize) * sizeof(Tcp_session));
+	ztcp_fdtabsize = newsize;
+    }
+    ztcp_fdtab[sess->fd] = sess;
+    sess->ifd = sess->fd;
+}
+
 /* "allocate" a tcp_session */
 static Tcp_session
 zts_alloc(int ztflags)
@@ -219,6 +253,7 @@ zts_alloc(int ztflags)
     sess = (Tcp_session)zshcalloc(sizeof(struct tcp_session));
     if (!sess) return NULL;
     sess->fd=-1;
+    sess->ifd=-1;
     sess->flags=ztflags;
 
     zinsertlinknode(ztcp_sessions, lastnode(ztcp_sessions), (void *)sess);
@@ -238,12 +273,14 @@ tcp_socket(int domain, int type, int protocol, int ztflags)
     sess->fd = socket(domain, type, protocol);
     /* We'll check failure and tidy up in caller */
     addmodulefd(sess->fd, FDT_MODULE);
+    zts_index(sess);
     return sess;
 }
 
 static int
 ztcp_free_session(Tcp_session sess)
 {
+    zsfree(sess->poolkey);
     zfree(sess, sizeof(struct tcp_session));
 
     return 0;
@@ -261,6 +298,8 @@ zts_delete(Tcp_session sess)
 	return 1;
     }
 
+    sess->fd = -1;
+    zts_index(sess);
     ztcp_free_session(getdata(node));
     remnode(ztcp_sessions, node);
 
@@ -271,10 +310,17 @@ static Tcp_session
 zts_byfd(int fd)
 {
     LinkNode node;
-    
+    Tcp_session sess;
+
+    if (fd >= 0 && fd < ztcp_fdtabsize &&
+	(sess = ztcp_fdtab[fd]) && sess->fd == fd)
+	return sess;
+
     for (node = firstnode(ztcp_sessions); node; incnode(node))
-	if (((Tcp_session)getdata(node))->fd == fd)
-	    return (Tcp_session)getdata(node);
+	if ((sess = (Tcp_session)getdata(node))->fd == fd) {
+	    zts_index(sess);
+	    return sess;
+	}
     
     return NULL;
 }
@@ -338,12 +384,225 @@ tcp_connect(Tcp_session sess, char *addrp, struct hostent *zhost, int d_port)
     return connect(sess->fd, (struct sockaddr *)&(sess->peer), salen);
 }
 
+/*
+ * Wait up to timeout milliseconds (indefinitely if negative) for fd
+ * to become writable, as it does when a connection completes.
+ * Returns 1 if it did, 0 on timeout, -1 on error.
+ */
+
+static int
+tcp_wait_writable(int fd, int timeout)
+{
+    int ret;
+#ifdef HAVE_POLL
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    while ((ret = poll(&pfd, 1, timeout)) < 0 && errno == EINTR && !errflag)
+	;
+#else
+# ifdef HAVE_SELECT
+    fd_set wfds;
+    struct timeval tv;
+
+    do {
+	FD_ZERO(&wfds);
+	FD_SET(fd, &wfds);
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	ret = select(fd+1, NULL, (SELECT_ARG_2_T) &wfds, NULL,
+		     timeout < 0 ? NULL : &tv);
+    } while (ret < 0 && errno == EINTR && !errflag);
+# else
+    ret = 1;
+# endif
+#endif
+    return ret < 0 ? -1 : ret > 0;
+}
+
+/*
+ * Finish a connection started without blocking.  Returns 0 if it
+ * is complete, -1 with errno set if it failed or is still pending
+ * (EINPROGRESS) after timeout milliseconds.
+ */
+
+/**/
+mod_export int
+tcp_connect_finish(Tcp_session sess, int timeout)
+{
+    int err = 0;
+    ZSOCKLEN_T len = sizeof(err);
+    long flags;
+
+    switch (tcp_wait_writable(sess->fd, timeout)) {
+    case -1:
+	return -1;
+    case 0:
+	errno = EINPROGRESS;
+	return -1;
+    }
+    if (getsockopt(sess->fd, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0)
+	return -1;
+    if (err) {
+	errno = err;
+	return -1;
+    }
+    /* connected: the caller gets an ordinary blocking socket */
+    if ((flags = fcntl(sess->fd, F_GETFL, 0)) != -1)
+	fcntl(sess->fd, F_SETFL, flags & ~O_NONBLOCK);
+    sess->flags &= ~ZTCP_PENDING;
+    return 0;
+}
+
+/*
+ * As tcp_connect(), but give up after timeout milliseconds.  If the
+ * timeout is zero, return at once; if the connection is still being
+ * made errno is EINPROGRESS and the session is marked ZTCP_PENDING
+ * for completion by tcp_connect_finish().  A negative timeout blocks
+ * as tcp_connect() does.
+ */
+
+/**/
+mod_export int
+tcp_connect_timeout(Tcp_session sess, char *addrp, struct hostent *zhost,
+		    int d_port, int timeout)
+{
+    long flags;
+    int ret;
+
+    if (timeout < 0 || (flags = fcntl(sess->fd, F_GETFL, 0)) == -1)
+	return tcp_connect(sess, addrp, zhost, d_port);
+
+    fcntl(sess->fd, F_SETFL, flags | O_NONBLOCK);
+    if (!(ret = tcp_connect(sess, addrp, zhost, d_port))) {
+	fcntl(sess->fd, F_SETFL, flags);
+	return 0;
+    }
+    if (errno != EINPROGRESS) {
+	int err = errno;
+	fcntl(sess->fd, F_SETFL, flags);
+	errno = err;
+	return ret;
+    }
+    sess->flags |= ZTCP_PENDING;
+    if (!timeout)
+	return ret;
+    if ((ret = tcp_connect_finish(sess, timeout)) && errno == EINPROGRESS)
+	errno = ETIMEDOUT;
+    return ret;
+}
+
+/*
+ * Check an idle pooled connection can be used again: the peer mustn't
+ * have closed it, and there mustn't be unread data from its last use.
+ */
+
+static int
+tcp_reusable(Tcp_session sess)
+{
+#ifdef HAVE_POLL
+    struct pollfd pfd;
+
+    pfd.fd = sess->fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 0;
+#else
+# ifdef HAVE_SELECT
+    fd_set rfds;
+    struct timeval tv;
+
+    FD_ZERO(&rfds);
+    FD_SET(sess->fd, &rfds);
+    tv.tv_sec = tv.tv_usec = 0;
+    return select(sess->fd+1, (SELECT_ARG_2_T) &rfds, NULL, NULL, &tv) == 0;
+# else
+    return 1;
+# endif
+#endif
+}
+
+/*
+ * Find an idle pooled connection for key, closing any that
+ * turn out to be unusable.  It is moved back to the lowest free fd,
+ * as a new connection would be; the shell won't redirect to the fd
+ * above 9 it was kept on.
+ */
+
+static Tcp_session
+tcp_pool_get(char *key)
+{
+    LinkNode node, next;
+    Tcp_session sess;
+    int fd;
+
+    for (node = firstnode(ztcp_sessions); node; node = next) {
+	next = nextnode(node);
+	sess = (Tcp_session)getdata(node);
+	if (!(sess->flags & ZTCP_IDLE) || strcmp(sess->poolkey, key))
+	    continue;
+	if (tcp_reusable(sess) && (fd = dup(sess->fd)) >= 0) {
+	    zclose(sess->fd);
+	    addmodulefd(fd, FDT_MODULE);
+	    sess->fd = fd;
+	    zts_index(sess);
+	    sess->flags &= ~ZTCP_IDLE;
+	    return sess;
+	}
+	tcp_close(sess);
+    }
+    return NULL;
+}
+
+/*
+ * Return a connection to its pool.  The fd is moved out of the way so
+ * that the number the user had it on is free for other use.
+ */
+
+static int
+tcp_pool_put(Tcp_session sess)
+{
+    int fd;
+
+    if (!sess->poolkey || (sess->flags & ZTCP_PENDING) ||
+	!tcp_reusable(sess) || (fd = fcntl(sess->fd, F_DUPFD, 10)) < 0) {
+	tcp_close(sess);
+	return 1;
+    }
+    zclose(sess->fd);
+    addmodulefd(fd, FDT_MODULE);
+    sess->fd = fd;
+    zts_index(sess);
+    sess->flags |= ZTCP_IDLE;
+    return 0;
+}
+
+/*
+ * Parse a timeout in seconds, returning milliseconds, or -1 if it's
+ * negative or too long to count in milliseconds in an int.
+ */
+
+static int
+ztcp_timeout(char *str)
+{
+    mnumber mn = matheval(str);
+
+    if (errflag)
+	return -1;
+    if (mn.type == MN_FLOAT)
+	return (mn.u.d >= 0 && mn.u.d <= INT_MAX / 1000) ?
+	    (int)(1000 * mn.u.d) : -1;
+    return (mn.u.l >= 0 && mn.u.l <= INT_MAX / 1000) ?
+	1000 * (int)mn.u.l : -1;
+}
+
 static int
 bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 {
     int herrno, err=1, destport, force=0, verbose=0, test=0, targetfd=0;
+    int timeout = -1;
     ZSOCKLEN_T  len;
-    char **addrp, *desthost, *localname, *remotename;
+    char **addrp, *desthost, *localname, *remotename, *poolkey = NULL;
     struct hostent *zthost = NULL, *ztpeer = NULL;
     struct servent *srv;
     Tcp_session sess = NULL;
@@ -357,6 +616,11 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
     if (OPT_ISSET(ops,'t'))
         test = 1;
 
+    if (OPT_ISSET(ops,'T') && (timeout = ztcp_timeout(OPT_ARG(ops,'T'))) < 0) {
+	zwarnnam(nam, "bad timeout: %s", OPT_ARG(ops,'T'));
+	return 1;
+    }
+
     if (OPT_ISSET(ops,'d')) {
 	targetfd = atoi(OPT_ARG(ops,'d'));
 	if (!targetfd) {
@@ -385,6 +649,10 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 		    zwarnnam(nam, "use -f to force closure of a zftp control connection");
 		    return 1;
 		}
+		if (OPT_ISSET(ops,'P') && !(sess->flags & ZTCP_IDLE)) {
+		    /* status 1 if it couldn't be kept */
+		    return tcp_pool_put(sess);
+		}
 		tcp_close(sess);
 		return 0;
 	    }
@@ -395,6 +663,30 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 	    }
 	}
     }
+    else if (test && !OPT_ISSET(ops,'a') && args[0]) {
+	/* test whether a connection started with -T 0 is complete */
+	char *ptr;
+
+	targetfd = (int)zstrtol(args[0], &ptr, 10);
+	if (*ptr || ptr == args[0] || args[1]) {
+	    /* -t used to be ignored here, so this may be a host name */
+	    zwarnnam(nam, "-t without -a takes a single fd argument");
+	    return 1;
+	}
+	if (!(sess = zts_byfd(targetfd))) {
+	    zwarnnam(nam, "fd %s not found in tcp table", args[0]);
+	    return 1;
+	}
+	if (!(sess->flags & ZTCP_PENDING))
+	    return 0;
+	if (!tcp_connect_finish(sess, timeout < 0 ? 0 : timeout))
+	    return 0;
+	if (errno == EINPROGRESS)
+	    return 1;
+	zwarnnam(nam, "connection failed: %e", errno);
+	tcp_close(sess);
+	return 2;
+    }
     else if (OPT_ISSET(ops,'l')) {
 	int lport = 0;
 
@@ -454,6 +746,7 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 	    /* move the fd since no one will want to read from it */
 	    sess->fd = movefd(sess->fd);
 	}
+	zts_index(sess);
 
 	if (sess->fd == -1) {
 	    zwarnnam(nam, "cannot duplicate fd %d: %e", sess->fd, errno);
@@ -561,6 +854,7 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 	else {
 	    sess->fd = rfd;
 	}
+	zts_index(sess);
 
 	setiparam_no_convert("REPLY", (zlong)sess->fd);
 
@@ -602,13 +896,15 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 			       localname, ntohs(sess->sock.in.sin_port),
 			       remotename, ntohs(sess->peer.in.sin_port));
 		    } else {
-			printf("%s:%d %s %s:%d is on fd %d%s\n",
+			printf("%s:%d %s %s:%d is on fd %d%s%s%s\n",
 			       localname, ntohs(sess->sock.in.sin_port),
 			       ((sess->flags & ZTCP_LISTEN) ? "-<" :
 				((sess->flags & ZTCP_INBOUND) ? "<-" : "->")),
 			       remotename, ntohs(sess->peer.in.sin_port),
 			       sess->fd,
-			       (sess->flags & ZTCP_ZFTP) ? " ZFTP" : "");
+			       (sess->flags & ZTCP_ZFTP) ? " ZFTP" : "",
+			       (sess->flags & ZTCP_IDLE) ? " IDLE" : "",
+			       (sess->flags & ZTCP_PENDING) ? " PENDING" : "");
 		    }
 		}
 	    }
@@ -626,6 +922,30 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 		destport = htons(atoi(args[1]));
 	}
 	
+	if (OPT_ISSET(ops,'P')) {
+	    char buf[DIGBUFSIZE];
+
+	    /* reuse an idle connection: no need to resolve the host */
+	    convbase(buf, (zlong)ntohs(destport), 10);
+	    poolkey = zhtricat(args[0], ":", buf);
+	    if ((sess = tcp_pool_get(poolkey))) {
+		if (targetfd) {
+		    sess->fd = redup(sess->fd, targetfd);
+		    if (sess->fd < 0) {
+			zerrnam(nam, "could not duplicate socket fd to %d: %e", targetfd, errno);
+			tcp_close(sess);
+			return 1;
+		    }
+		    zts_index(sess);
+		}
+		setiparam_no_convert("REPLY", (zlong)sess->fd);
+		if (verbose)
+		    printf("%s:%d is now on fd %d (reused)\n",
+			   args[0], ntohs(destport), sess->fd);
+		return 0;
+	    }
+	}
+
 	desthost = ztrdup(args[0]);
 	
 	zthost = zsh_getipnodebyname(desthost, AF_INET, 0, &herrno);
@@ -659,8 +979,13 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 	    if (zthost->h_length != 4)
 		zwarnnam(nam, "address length mismatch");
 	    do {
-		err = tcp_connect(sess, *addrp, zthost, destport);
+		err = tcp_connect_timeout(sess, *addrp, zthost, destport,
+					  timeout);
 	    } while (err && errno == EINTR && !errflag);
+	    if (err && errno == EINPROGRESS && !timeout) {
+		/* connection pending, check with ztcp -t */
+		err = 0;
+	    }
 	}
 	
 	if (err) {
@@ -679,7 +1004,10 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 		    tcp_close(sess);
 		    return 1;
 		}
+		zts_index(sess);
 	    }
+	    if (poolkey)
+		sess->poolkey = ztrdup(poolkey);
 
 	    setiparam_no_convert("REPLY", (zlong)sess->fd);
 
@@ -695,7 +1023,7 @@ bin_ztcp(char *nam, char **args, Options ops, UNUSED(int func))
 }
 
 static struct builtin bintab[] = {
-    BUILTIN("ztcp", 0, bin_ztcp, 0, 3, 0, "acd:flLtv", NULL),
+    BUILTIN("ztcp", 0, bin_ztcp, 0, 3, 0, "acd:flLPtT:v", NULL),
 };
 
 static struct features module_features = {
@@ -745,6 +1073,11 @@ cleanup_(Module m)
 {
     tcp_cleanup();
     freelinklist(ztcp_sessions, (FreeFunc) ztcp_free_session);
+    if (ztcp_fdtab) {
+	zfree(ztcp_fdtab, ztcp_fdtabsize * sizeof(Tcp_session));
+	ztcp_fdtab = NULL;
+	ztcp_fdtabsize = 0;
+    }
     return setfeatureenables(m, &module_features, NULL);
 }
 
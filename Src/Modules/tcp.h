@@ -83,6 +83,8 @@ typedef struct tcp_session *Tcp_session;
 
 #define ZTCP_LISTEN  1
 #define ZTCP_INBOUND 2
+#define ZTCP_IDLE    4		/* pooled connection not in use */
+#define ZTCP_PENDING 8		/* connection still being made */
 #define ZTCP_ZFTP    16
 
 struct tcp_session {
@@ -90,6 +92,8 @@ struct tcp_session {
     union tcp_sockaddr sock;  	/* local address   */
     union tcp_sockaddr peer;  	/* remote address  */
     int flags;
+    int ifd;			/* fd under which indexed, or -1 */
+    char *poolkey;		/* host:port if pooled, else NULL */
 };
 
 #include "tcp.pro"
@@ -69,6 +69,27 @@ typedef struct zftp_session *Zftp_session;
 # undef HAVE_POLL
 #endif
 
+/*
+ * With poll() or select(), timeouts on the data connection are
+ * handled by waiting for the connection to become ready rather than
+ * with SIGALRM.
+ */
+#if defined(HAVE_POLL) || defined(HAVE_SELECT)
+# define ZF_WAITFD 1
+#endif
+
+/* Test if errno says a non-blocking write would have blocked */
+#ifdef EWOULDBLOCK
+# define ZF_WOULDBLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#else
+# define ZF_WOULDBLOCK(e) ((e) == EAGAIN)
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+# define ZF_SENDFILE 1
+#endif
+
 
 #ifdef USE_LOCAL_H_ERRNO
 int h_errno;
@@ -182,6 +203,7 @@ static struct zftpcmd zftpcmdtab[] = {
     { "quit", zftp_close, 0, 0, ZFTP_CONN },
     { "session", zftp_session, 0, 1, ZFTP_SESS },
     { "rmsession", zftp_rmsession, 0, 1, ZFTP_SESS },
+    { "clone", zftp_clone, 1, 1, ZFTP_SESS },
     { 0, 0, 0, 0, 0 }
 };
 
@@ -372,6 +394,12 @@ zfhandler(int sig)
 #else
 	errno = EIO;
 #endif
+	/*
+	 * longjmp() needn't restore the signal mask, and we don't
+	 * want the next timeout to be held off until we return
+	 * to the shell.
+	 */
+	signal_unblock(signal_mask(SIGALRM));
 	longjmp(zfalrmbuf, 1);
     }
     DPUTS(1, "zfhandler caught incorrect signal");
@@ -1306,6 +1334,69 @@ zfendtrans(void)
     zfunsetparam("ZFTP_COUNT");
 }
 
+#ifdef ZF_WAITFD
+/*
+ * Wait up to tmout seconds for fd to be ready for reading, or for
+ * writing if out is set.  Returns 1 if it is, 0 on a timeout (with
+ * zfdrrrring set as if an alarm had gone off), -1 on error.
+ */
+
+static int
+zfwaitfd(int fd, int out, int tmout)
+{
+    int ret;
+# ifdef HAVE_POLL
+    struct pollfd pfd;
+
+#  ifndef POLLIN
+#   define POLLIN POLLNORM
+#  endif
+#  ifndef POLLOUT
+#   define POLLOUT POLLWRNORM
+#  endif
+    pfd.fd = fd;
+    pfd.events = out ? POLLOUT : POLLIN;
+    while ((ret = poll(&pfd, 1, tmout * 1000)) < 0 &&
+	   errno == EINTR && !errflag)
+	;
+# else
+    fd_set f;
+    struct timeval tv;
+
+    do {
+	FD_ZERO(&f);
+	FD_SET(fd, &f);
+	tv.tv_sec = tmout;
+	tv.tv_usec = 0;
+	ret = select(fd + 1, out ? NULL : (SELECT_ARG_2_T) &f,
+		     out ? (SELECT_ARG_2_T) &f : NULL, NULL, &tv);
+    } while (ret < 0 && errno == EINTR && !errflag);
+# endif
+    if (!ret) {
+	zfdrrrring = 1;
+#ifdef ETIMEDOUT
+	errno = ETIMEDOUT;
+#else
+	errno = EIO;
+#endif
+    }
+    return ret < 0 ? -1 : ret > 0;
+}
+
+/*
+ * Wait for fd to be ready for writing, giving up at the time
+ * deadline.  Returns as zfwaitfd().
+ */
+
+static int
+zfwaitwrite(int fd, time_t deadline)
+{
+    time_t left = deadline - time(NULL);
+
+    return zfwaitfd(fd, 1, left > 0 ? (int)left : 0);
+}
+#endif /* ZF_WAITFD */
+
 /* Read with timeout if recv is set. */
 
 /**/
@@ -1317,6 +1408,14 @@ zfread(int fd, char *bf, off_t sz, int tmout)
     if (!tmout)
 	return read(fd, bf, sz);
 
+#ifdef ZF_WAITFD
+    if ((ret = zfwaitfd(fd, 0, tmout)) <= 0) {
+	if (!ret)
+	    zwarnnam("zftp", "timeout on network read");
+	return -1;
+    }
+    return read(fd, bf, sz);
+#else
     if (setjmp(zfalrmbuf)) {
 	alarm(0);
 	zwarnnam("zftp", "timeout on network read");
@@ -1329,9 +1428,16 @@ zfread(int fd, char *bf, off_t sz, int tmout)
     /* we don't bother turning off the whole alarm mechanism here */
     alarm(0);
     return ret;
+#endif
 }
 
-/* Write with timeout if recv is not set. */
+/*
+ * Write with timeout if recv is not set.  With a timeout, the data
+ * connection is non-blocking (see zfsenddata()), so that the whole
+ * buffer has to be sent within the timeout, as when an alarm
+ * interrupted the write, even if the other end stops reading it part
+ * way through.
+ */
 
 /**/
 static int
@@ -1342,6 +1448,27 @@ zfwrite(int fd, char *bf, off_t sz, int tmout)
     if (!tmout)
 	return write(fd, bf, sz);
 
+#ifdef ZF_WAITFD
+    {
+	time_t deadline = time(NULL) + tmout;
+	off_t done = 0;
+
+	while (done < sz) {
+	    if ((ret = zfwaitwrite(fd, deadline)) <= 0) {
+		if (!ret)
+		    zwarnnam("zftp", "timeout on network write");
+		return -1;
+	    }
+	    if ((ret = write(fd, bf + done, sz - done)) < 0) {
+		if (ZF_WOULDBLOCK(errno))
+		    continue;
+		return done ? (int)done : -1;
+	    }
+	    done += ret;
+	}
+	return (int)done;
+    }
+#else
     if (setjmp(zfalrmbuf)) {
 	alarm(0);
 	zwarnnam("zftp", "timeout on network write");
@@ -1354,7 +1481,74 @@ zfwrite(int fd, char *bf, off_t sz, int tmout)
     /* we don't bother turning off the whole alarm mechanism here */
     alarm(0);
     return ret;
+#endif
+}
+
+#ifdef ZF_SENDFILE
+/*
+ * Send a local file to the data connection fdout with sendfile(),
+ * avoiding copying through our buffer.  This is used for uploads in
+ * image type and stream mode when standard input is a regular file.
+ * Returns the number of bytes sent, -1 on error, or -2 if sendfile()
+ * can't be used for this file, in which case nothing was sent.
+ * Progress is reported every bufsize bytes, each of which must be
+ * sent within the timeout; as for zfwrite(), fdout is non-blocking
+ * when there is a timeout.
+ */
+
+static int
+zfsendfile(char *name, int fdin, int fdout, int tmout, int bufsize,
+	   int progress, off_t *sofarp)
+{
+    Shfunc shfunc;
+    struct stat st;
+    ssize_t n;
+    int sent = 0, chunk = 0;
+    time_t deadline = time(NULL) + tmout;
+
+    if (fstat(fdin, &st) < 0 || !S_ISREG(st.st_mode))
+	return -2;
+    for (;;) {
+	if (tmout) {
+	    int ret = zfwaitwrite(fdout, deadline);
+	    if (ret <= 0) {
+		if (!ret)
+		    zwarnnam(name, "timeout on network write");
+		return -1;
+	    }
+	}
+	if ((n = sendfile(fdout, fdin, NULL, bufsize - chunk)) < 0) {
+	    if ((errno == EINTR && !errflag) || ZF_WOULDBLOCK(errno))
+		continue;
+	    /* e.g. EINVAL, not supported for this file: fall back */
+	    if (!sent && (errno == EINVAL || errno == ENOSYS))
+		return -2;
+	    if (!errflag)
+		zwarnnam(name, "write failed: %e", errno);
+	    return -1;
+	}
+	if (!n && !chunk)
+	    break;
+	sent = 1;
+	*sofarp += n;
+	if (n && (chunk += n) < bufsize)
+	    continue;
+	chunk = 0;
+	deadline = time(NULL) + tmout;
+	if (progress && (shfunc = getshfunc("zftp_progress"))) {
+	    int osc = sfcontext;
+
+	    zfsetparam("ZFTP_COUNT", sofarp, ZFPM_READONLY|ZFPM_INTEGER);
+	    sfcontext = SFC_HOOK;
+	    doshfunc(shfunc, NULL, 1);
+	    sfcontext = osc;
+	}
+	if (errflag)
+	    return -1;
+    }
+    return 0;
 }
+#endif /* ZF_SENDFILE */
 
 static int zfread_eof;
 
@@ -1445,6 +1639,14 @@ zfwrite_block(int fd, char *bf, off_t sz, int tmout)
     return sz;
 }
 
+/*
+ * Default size of the buffer for transfers; ZFTP_BUFSIZE can
+ * make it larger in stream mode.  In block mode the block size
+ * is limited by the 16-bit header, so we always use the default.
+ */
+#define ZF_BUFSIZE 32768
+#define ZF_MAXBUFSIZE (16*1024*1024)
+
 /*
  * Move stuff from fdin to fdout, tidying up the data connection
  * when finished.  The data connection could be either input or output:
@@ -1461,12 +1663,10 @@ zfwrite_block(int fd, char *bf, off_t sz, int tmout)
 static int
 zfsenddata(char *name, int recv, int progress, off_t startat)
 {
-#define ZF_BUFSIZE 32768
-#define ZF_ASCSIZE (ZF_BUFSIZE/2)
     /* ret = 2 signals the local read/write failed, so send abort */
     int n, ret = 0, gotack = 0, fdin, fdout, fromasc = 0, toasc = 0;
-    int rtmout = 0, wtmout = 0;
-    char lsbuf[ZF_BUFSIZE], *ascbuf = NULL, *optr;
+    int rtmout = 0, wtmout = 0, bufsize = ZF_BUFSIZE, ascsize, dflags = -1;
+    char *lsbuf, *ascbuf = NULL, *optr;
     off_t sofar = 0, last_sofar = 0;
     readwrite_t read_ptr = zfread, write_ptr = zfwrite;
     Shfunc shfunc;
@@ -1503,13 +1703,41 @@ zfsenddata(char *name, int recv, int progress, off_t startat)
 	    write_ptr = zfwrite_block;
     }
 
+    if (ZFST_MODE(zfstatusp[zfsessno]) != ZFST_BLOC) {
+	zlong bs = getiparam("ZFTP_BUFSIZE");
+	if (bs > ZF_BUFSIZE)
+	    bufsize = (bs > ZF_MAXBUFSIZE) ? ZF_MAXBUFSIZE : (int)bs;
+    }
+    ascsize = bufsize / 2;
+    lsbuf = zalloc(bufsize);
     if (toasc)
-	ascbuf = zalloc(ZF_ASCSIZE);
+	ascbuf = zalloc(ascsize);
     zfpipe();
     zfread_eof = 0;
+#ifdef ZF_WAITFD
+    /* see zfwrite() */
+    if (wtmout && (dflags = fcntl(fdout, F_GETFL, 0)) != -1)
+	fcntl(fdout, F_SETFL, dflags | O_NONBLOCK);
+#endif
+#ifdef ZF_SENDFILE
+    if (!recv && !toasc && read_ptr == zfread && write_ptr == zfwrite) {
+	/* Nothing to convert, so the kernel can copy the file for us */
+	switch (zfsendfile(name, fdin, fdout, wtmout, bufsize, progress,
+			   &sofar)) {
+	case -2:
+	    break;
+	case -1:
+	    ret = 1;
+	    break;
+	default:
+	    zfread_eof = 1;
+	    break;
+	}
+    }
+#endif
     while (!ret && !zfread_eof) {
-	n = (toasc) ? read_ptr(fdin, ascbuf, ZF_ASCSIZE, rtmout)
-	    : read_ptr(fdin, lsbuf, ZF_BUFSIZE, rtmout);
+	n = (toasc) ? read_ptr(fdin, ascbuf, ascsize, rtmout)
+	    : read_ptr(fdin, lsbuf, bufsize, rtmout);
 	if (n > 0) {
 	    char *iptr;
 	    if (toasc) {
@@ -1629,6 +1857,8 @@ zfsenddata(char *name, int recv, int progress, off_t startat)
 	/* send an end-of-file marker block */
 	ret = (zfwrite_block(fdout, lsbuf, 0, wtmout) < 0);
     }
+    if (dflags != -1)
+	fcntl(fdout, F_SETFL, dflags);
     if (errflag || ret > 1) {
 	/*
 	 * some error occurred, maybe a keyboard interrupt, or
@@ -1682,7 +1912,22 @@ zfsenddata(char *name, int recv, int progress, off_t startat)
     }
 	
     if (toasc)
-	zfree(ascbuf, ZF_ASCSIZE);
+	zfree(ascbuf, ascsize);
+    zfree(lsbuf, bufsize);
+#ifdef SO_LINGER
+    if (ret && !recv) {
+	/*
+	 * Don't linger over data the other end isn't reading when
+	 * the upload failed, else closing would outlast the timeout.
+	 */
+	struct linger li;
+
+	li.l_onoff = 1;
+	li.l_linger = 0;
+	setsockopt(zfsess->dfd, SOL_SOCKET, SO_LINGER,
+		   (char *)&li, sizeof(li));
+    }
+#endif
     zfclosedata();
     if (!gotack && zfgetmsg() > 2)
 	ret = 1;
@@ -2754,7 +2999,7 @@ zfclose(int leaveparams)
 	if (!zfnopen) {
 	    /* Write the final status in case this is a subshell */
 	    lseek(zfstatfd, zfsessno*sizeof(int), 0);
-	    write_loop(zfstatfd, (char *)zfstatusp+zfsessno, sizeof(int));
+	    write_loop(zfstatfd, (char *)(zfstatusp+zfsessno), sizeof(int));
 
 	    close(zfstatfd);
 	    zfstatfd = -1;
@@ -2880,10 +3125,10 @@ freesession(Zftp_session sptr)
 {
     char **ps, **pd;
     zsfree(sptr->name);
-    for (ps = zfparams, pd = zfsess->params; *ps; ps++, pd++)
+    for (ps = zfparams, pd = sptr->params; *ps; ps++, pd++)
 	if (*pd)
 	    zsfree(*pd);
-    zfree(zfsess->params, sizeof(zfparams));
+    zfree(sptr->params, sizeof(zfparams));
     if (sptr->userparams)
 	freearray(sptr->userparams);
     zfree(sptr, sizeof(struct zftp_session));
@@ -2913,6 +3158,33 @@ zftp_session(UNUSED(char *name), char **args, UNUSED(int flags))
     return 0;
 }
 
+/*
+ * Create a new session with the same user parameters (host, user and
+ * so on) as the current one and switch to it.  Opening it then makes
+ * a second connection to the same server, so several transfers can
+ * run at once from separate processes.
+ */
+
+/**/
+static int
+zftp_clone(char *name, char **args, UNUSED(int flags))
+{
+    char **uparams = zfsess->userparams;
+    LinkNode nptr;
+
+    for (nptr = firstnode(zfsessions); nptr; incnode(nptr))
+	if (!strcmp(((Zftp_session)nptr->dat)->name, *args)) {
+	    zwarnnam(name, "session already exists: %s", *args);
+	    return 1;
+	}
+
+    savesession();
+    switchsession(*args);
+    if (uparams)
+	zfsess->userparams = zarrdup(uparams);
+    return 0;
+}
+
 /* Remove a session and free it */
 
 /**/
@@ -2951,14 +3223,19 @@ zftp_rmsession(UNUSED(char *name), char **args, UNUSED(int flags))
 	}
     } else {
 	Zftp_session oldsess = zfsess;
+	int oldsessno = zfsessno;
 	zfsess = sptr;
+	zfsessno = no;
 	/*
 	 * Freeing another session: don't need to switch, just
-	 * tell zfclose() not to delete parameters etc.
+	 * tell zfclose() not to delete parameters etc.  It marks
+	 * the status of the session it closes, so that has to be
+	 * the one we are freeing, too.
 	 */
 	zfclosedata();
 	zfclose(1);
 	zfsess = oldsess;
+	zfsessno = (no < oldsessno) ? oldsessno - 1 : oldsessno;
     }
     remnode(zfsessions, nptr);
     freesession(sptr);
@@ -3124,7 +3401,7 @@ bin_zftp(char *name, char **args, UNUSED(Options ops), UNUSED(int func))
 	 * but only for the active session.
 	 */
 	lseek(zfstatfd, zfsessno*sizeof(int), 0);
-	write_loop(zfstatfd, (char *)zfstatusp+zfsessno, sizeof(int));
+	write_loop(zfstatfd, (char *)(zfstatusp+zfsessno), sizeof(int));
     }
     return ret;
 }
@@ -3206,6 +3483,8 @@ boot_(UNUSED(Module m))
     off_t tmout_def = 60;
     zfsetparam("ZFTP_VERBOSE", ztrdup("450"), ZFPM_IFUNSET);
     zfsetparam("ZFTP_TMOUT", &tmout_def, ZFPM_IFUNSET|ZFPM_INTEGER);
+    tmout_def = ZF_BUFSIZE;
+    zfsetparam("ZFTP_BUFSIZE", &tmout_def, ZFPM_IFUNSET|ZFPM_INTEGER);
     zfsetparam("ZFTP_PREFS", ztrdup("PS"), ZFPM_IFUNSET);
     /* default preferences if user deletes variable */
     zfprefs = ZFPF_SNDP|ZFPF_PASV;
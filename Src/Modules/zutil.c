@@ -83,29 +83,69 @@ freematch(MatchData *m)
 
 typedef struct stypat *Stypat;
 typedef struct style *Style;
+typedef struct stymemo *Stymemo;
 
 /* A pattern and the styles for it. */
 
 struct style {
     struct hashnode node;
     Stypat pats;		/* patterns */
+    Stymemo *memo;		/* contexts already looked up, see below */
+    int nmemo;			/* number of entries in memo */
 };
 
 struct stypat {
     Stypat next;
     char *pat;			/* pattern string */
     Patprog prog;		/* compiled pattern */
+    int plen;			/* length of literal prefix of pat */
     int weight;			/* how specific is the pattern? */
     Eprog eval;			/* eval-on-retrieve? */
     char **vals;
 };
 
+/*
+ * The completion system looks up the same styles in the same contexts
+ * over and over again, so for every style we remember which pattern
+ * (if any) matched a context.  The memo is thrown away whenever the
+ * patterns for the style change and when it gets too big.
+ */
+
+struct stymemo {
+    Stymemo next;		/* next in hash chain */
+    unsigned int hash;		/* hash value of ctxt */
+    char *ctxt;			/* the context */
+    Stypat pat;			/* first matching pattern or NULL */
+};
+
+#define STYMEMO_SLOTS 64
+#define STYMEMO_MAX   512
+
 /* Hash table of styles and associated functions. */
 
 static HashTable zstyletab;
 
 /* Memory stuff. */
 
+static void
+freestymemo(Style s)
+{
+    Stymemo m, n;
+    int i;
+
+    if (!s->memo)
+	return;
+    for (i = 0; i < STYMEMO_SLOTS; i++)
+	for (m = s->memo[i]; m; m = n) {
+	    n = m->next;
+	    zsfree(m->ctxt);
+	    zfree(m, sizeof(*m));
+	}
+    zfree(s->memo, STYMEMO_SLOTS * sizeof(Stymemo));
+    s->memo = NULL;
+    s->nmemo = 0;
+}
+
 static void
 freestylepatnode(Stypat p)
 {
@@ -130,6 +170,7 @@ freestylenode(HashNode hn)
 	freestylepatnode(p);
 	p = pn;
     }
+    freestymemo(s);
 
     zsfree(s->node.nam);
     zfree(s, sizeof(struct style));
@@ -154,6 +195,7 @@ freestypat(Stypat p, Style s, Stypat prev)
 	    prev->next = p->next;
 	else
 	    s->pats = p->next;
+	freestymemo(s);
     }
 
     freestylepatnode(p);
@@ -312,6 +354,7 @@ setstypat(Style s, char *pat, Patprog prog, char **vals, int eval)
 
 	eprog = dupeprog(eprog, 0);
     }
+    freestymemo(s);
     for (p = s->pats; p; p = p->next)
 	if (!strcmp(pat, p->pat)) {
 
@@ -337,6 +380,16 @@ setstypat(Style s, char *pat, Patprog prog, char **vals, int eval)
     p->eval = eprog;
     p->next = NULL;
 
+    /* Get the part of the pattern that has to match literally. */
+
+    for (str = pat; *str; str++)
+	if (*str == '(' || *str == '|' || *str == '*' || *str == '[' ||
+	    *str == '<' || *str == '?' || *str == '#' || *str == '^' ||
+	    *str == '~' || *str == '@' || *str == '+' || *str == '!' ||
+	    *str == '\\')
+	    break;
+    p->plen = str - pat;
+
     /* Calculate the weight. */
 
     for (weight = 0, tmp = 2, first = 1, str = pat; *str; str++) {
@@ -414,6 +467,48 @@ evalstyle(Stypat p)
     return ret;
 }
 
+/* Find the first pattern for style s matching the context, using
+ * and filling the memo. */
+
+static Stypat
+lookupstypat(Style s, char *ctxt)
+{
+    Stymemo m;
+    Stypat p;
+    unsigned int h = hasher(ctxt);
+
+    if (s->memo) {
+	for (m = s->memo[h % STYMEMO_SLOTS]; m; m = m->next)
+	    if (m->hash == h && !strcmp(m->ctxt, ctxt)) {
+		/*
+		 * Patterns for -e styles have to be tried again so that
+		 * the code sees $match etc. for (#b).
+		 */
+		if ((p = m->pat) && p->eval)
+		    pattry(p->prog, ctxt);
+		return p;
+	    }
+    }
+    for (p = s->pats; p; p = p->next)
+	if ((!p->plen || !strncmp(p->pat, ctxt, p->plen)) &&
+	    pattry(p->prog, ctxt))
+	    break;
+
+    if (s->nmemo >= STYMEMO_MAX)
+	freestymemo(s);
+    if (!s->memo)
+	s->memo = (Stymemo *) zshcalloc(STYMEMO_SLOTS * sizeof(Stymemo));
+    m = (Stymemo) zalloc(sizeof(*m));
+    m->hash = h;
+    m->ctxt = ztrdup(ctxt);
+    m->pat = p;
+    m->next = s->memo[h % STYMEMO_SLOTS];
+    s->memo[h % STYMEMO_SLOTS] = m;
+    s->nmemo++;
+
+    return p;
+}
+
 /* Look up a style for a context pattern. This does the matching. */
 
 static char **
@@ -427,11 +522,8 @@ lookupstyle(char *ctxt, char *style)
     if (s) {
 	MatchData match;
 	savematch(&match);
-	for (p = s->pats; p; p = p->next)
-	    if (pattry(p->prog, ctxt)) {
-		found = (p->eval ? evalstyle(p) : p->vals);
-		break;
-	    }
+	if ((p = lookupstypat(s, ctxt)))
+	    found = (p->eval ? evalstyle(p) : p->vals);
 	restorematch(&match);
     }
 
@@ -29,11 +29,13 @@
 
 typedef struct cmatcher  *Cmatcher;
 typedef struct cmlist    *Cmlist;
+typedef struct cmfilter  *Cmfilter;
 typedef struct cpattern  *Cpattern;
 typedef struct menuinfo  *Menuinfo;
 typedef struct cexpl *Cexpl;
 typedef struct cmgroup *Cmgroup;
 typedef struct cmatch *Cmatch;
+typedef struct cmarena *Cmarena;
 
 /* This is for explantion strings. */
 
@@ -76,11 +78,24 @@ struct cmgroup {
     int totl;			/* total length */
     int shortest;		/* length of shortest match */
     Cmgroup perm;		/* perm. alloced version of this group */
+    Cmarena *arenas;		/* storage of the perm. alloced matches */
+    int narenas;		/* number of arenas */
 #ifdef ZSH_HEAP_DEBUG
     Heapid heap_id;
 #endif
 };
 
+/* Storage for permanently allocated matches.  The match structures, *
+ * their brace positions and their strings are copied into one block *
+ * which may be shared by several versions of a group.                */
+
+struct cmarena {
+    int refc;			/* number of groups using this */
+    size_t size;		/* size of mem */
+    char *mem;			/* the matches, then the strings */
+    Cmatch all;			/* CMF_ALL match, its disp is zalloc'ed */
+};
+
 
 #define CGF_NOSORT   1		/* don't sort this group */
 #define CGF_LINES    2		/* these are to be printed on different lines */
@@ -119,6 +134,7 @@ struct cmatch {
     char modec;                 /* LIST_TYPE-character for mode or nul */
     mode_t fmode;               /* mode field of a stat, following symlink */
     char fmodec;                /* LIST_TYPE-character for fmode or nul */
+    Cmatch perm;		/* perm. alloced copy of this match */
 };
 
 #define CMF_FILE     (1<< 0)	/* this is a file */
@@ -165,6 +181,21 @@ struct cmatcher {
 #define CMF_RIGHT 4
 #define CMF_INTER 8
 
+/*
+ * A pre-compiled test used by compadd to throw away words that can't
+ * possibly be matched by the prefix from the line before doing the
+ * real (and expensive) matching with comp_match().  pfx is the
+ * leading part of the line prefix consisting only of characters that
+ * are never changed by quoting; allow, if not NULL, has one bitmap
+ * per character in it with the (ASCII) word characters that the
+ * active matchers may match there.  See get_cmfilter().
+ */
+struct cmfilter {
+    char *pfx;			/* usable part of the line prefix */
+    int len;			/* its length */
+    unsigned char *allow;	/* len * 16 bytes of word character sets */
+};
+
 /*
  * Types of cpattern structure.
  * Note freecpattern() assumes any <= CPAT_EQUIV have string.
@@ -424,9 +455,11 @@ typedef void (*CLPrintFunc)(Cmgroup, Cmatch *, int, int, int, int);
 #define CP_QUOTES      (1 << CPN_QUOTES)
 #define CPN_IGNORED    25
 #define CP_IGNORED     (1 << CPN_IGNORED)
+#define CPN_CACHE      26
+#define CP_CACHE       (1 << CPN_CACHE)
 
-#define CP_KEYPARAMS   26
-#define CP_ALLKEYS     ((unsigned int) 0x3ffffff)
+#define CP_KEYPARAMS   27
+#define CP_ALLKEYS     ((unsigned int) 0x7ffffff)
 
 /* Hooks. */
 
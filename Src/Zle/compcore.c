@@ -134,6 +134,22 @@ LinkList fmatches;
 /**/
 mod_export Cmgroup lastmatches, pmatches, amatches, lmatches, lastlmatches;
 
+/* Non-zero if generation of the current list of matches was cut short: *
+ * COMPCANCEL_TIMEOUT if $ZLE_COMPLETION_TIMEOUT expired, or             *
+ * COMPCANCEL_TYPEAHEAD if the user typed something in the meantime.     */
+
+#define COMPCANCEL_TIMEOUT   1
+#define COMPCANCEL_TYPEAHEAD 2
+
+/**/
+int compcancelled;
+
+/* What may cancel completion, the time by which it has to be finished  *
+ * and whether the interrupt flag used to unwind was set by us.          */
+
+static int compcancelwhat, compcancelint;
+static struct timeval compdeadline;
+
 /* Non-zero if we have permanently allocated matches (old and new). */
 
 /**/
@@ -339,6 +355,8 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
     nmessages = 0;
     hasallmatch = 0;
 
+    startcompcancel();
+
     /* Make sure we have the completion list and compctl. */
     if (makecomplist(s, incmd, lst)) {
 	/* Error condition: feeeeeeeeeeeeep(). */
@@ -347,8 +365,12 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
 	inststr(origline);
 	zlemetacs = origcs;
 	clearlist = 1;
-	ret = 1;
 	minfo.cur = NULL;
+	if (compcancelled == COMPCANCEL_TYPEAHEAD) {
+	    /* Silently leave the line alone, the keys are still waiting. */
+	    goto compend;
+	}
+	ret = 1;
 	if (useline < 0) {
 	    /* unmetafy line before calling ZLE */
 	    unmetafy_line();
@@ -451,6 +473,509 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
     return ret;
 }
 
+/*
+ * Set up cancellation for the completion about to be generated.
+ * $ZLE_COMPLETION_TIMEOUT gives the time in hundredths of a second
+ * after which no more matches are added; a non-empty
+ * $ZLE_COMPLETION_INTERRUPT makes typeahead abandon the completion.
+ */
+
+/**/
+static void
+startcompcancel(void)
+{
+    zlong tmout = getiparam("ZLE_COMPLETION_TIMEOUT");
+    char *intr = getsparam("ZLE_COMPLETION_INTERRUPT");
+
+    compcancelled = compcancelint = compcancelwhat = 0;
+    if (tmout > 0) {
+	struct timezone dummy_tz;
+
+	gettimeofday(&compdeadline, &dummy_tz);
+	compdeadline.tv_sec += tmout / 100;
+	compdeadline.tv_usec += (tmout % 100) * 10000;
+	if (compdeadline.tv_usec >= 1000000) {
+	    compdeadline.tv_sec++;
+	    compdeadline.tv_usec -= 1000000;
+	}
+	compcancelwhat |= COMPCANCEL_TIMEOUT;
+    }
+#ifdef FIONREAD
+    if (intr && *intr)
+	compcancelwhat |= COMPCANCEL_TYPEAHEAD;
+#endif
+}
+
+/*
+ * Cancellation point, called while matches are being added.  Returns
+ * non-zero if completion should stop; the first time that happens the
+ * interrupt flag is raised so that the completion function unwinds.
+ */
+
+/**/
+static int
+compcheckcancel(void)
+{
+    if (compcancelled)
+	return 1;
+    if (!compcancelwhat)
+	return 0;
+#ifdef FIONREAD
+    if (compcancelwhat & COMPCANCEL_TYPEAHEAD) {
+	int val = 0;
+
+	if (ioctl(SHTTY, FIONREAD, (char *)&val) == 0 && val > 0)
+	    compcancelled = COMPCANCEL_TYPEAHEAD;
+    }
+#endif
+    if (!compcancelled && (compcancelwhat & COMPCANCEL_TIMEOUT)) {
+	struct timeval now;
+	struct timezone dummy_tz;
+
+	gettimeofday(&now, &dummy_tz);
+	if (now.tv_sec > compdeadline.tv_sec ||
+	    (now.tv_sec == compdeadline.tv_sec &&
+	     now.tv_usec >= compdeadline.tv_usec))
+	    compcancelled = COMPCANCEL_TIMEOUT;
+    }
+    if (!compcancelled)
+	return 0;
+    if (!(errflag & ERRFLAG_INT)) {
+	errflag |= ERRFLAG_INT;
+	compcancelint = 1;
+    }
+    return 1;
+}
+
+/*
+ * The result cache.  If the completion function sets compstate[cache]
+ * to `keep', the compadd calls it made are remembered together with
+ * the values of the special completion parameters at each call.  When
+ * the next completion is in the same context (same command line words,
+ * context, widget, directory and so on) and its $PREFIX only adds some
+ * plain characters to the old one, the calls are replayed against the
+ * new prefix instead of calling the function again.  Matching them
+ * with comp_match() as usual narrows the list; only the words that
+ * still match are remembered for the next round.
+ */
+
+typedef struct crcadd *Crcadd;
+
+struct crcadd {
+    Crcadd next;
+    struct cadata dat;		/* the options of the compadd call */
+    char *prefix, *suffix;	/* $PREFIX and $SUFFIX at the time */
+    char *iprefix, *isuffix;	/* $IPREFIX and $ISUFFIX */
+    char *qiprefix, *qisuffix;	/* $QIPREFIX and $QISUFFIX */
+    char *quote, *exact;	/* compstate[quote] and compstate[exact] */
+    char **ign;			/* the -F patterns */
+    char **words;		/* the words that matched */
+    char **disp;		/* their display strings */
+    int nwords, ndisp, szwords, szdisp;
+};
+
+typedef struct crcache *Crcache;
+
+struct crcache {
+    char *key;			/* context, command line words etc. */
+    int keylen;
+    char *prefix;		/* $PREFIX the function was called with */
+    int bad;			/* non-zero if this can't be replayed */
+    Crcadd adds, lastadd;
+    /* compstate values on return from the function */
+    char *list, *insert, *exact, *exactstr, *patinsert, *lastprompt;
+    char *toend;
+    zlong listmax;
+};
+
+/* The current cache entry and the one being recorded. */
+
+static Crcache rescache, resrec;
+
+/* The compadd call being replayed, if any. */
+
+static Crcadd resplay;
+
+static void
+freecradd(Crcadd a)
+{
+    Cadata dat = &a->dat;
+
+    zsfree(dat->ipre);
+    zsfree(dat->isuf);
+    zsfree(dat->ppre);
+    zsfree(dat->psuf);
+    zsfree(dat->prpre);
+    zsfree(dat->pre);
+    zsfree(dat->suf);
+    zsfree(dat->group);
+    zsfree(dat->rems);
+    zsfree(dat->remf);
+    zsfree(dat->exp);
+    zsfree(dat->mesg);
+    if (dat->match)
+	freecmatcher(dat->match);
+    zsfree(a->prefix);
+    zsfree(a->suffix);
+    zsfree(a->iprefix);
+    zsfree(a->isuffix);
+    zsfree(a->qiprefix);
+    zsfree(a->qisuffix);
+    zsfree(a->quote);
+    zsfree(a->exact);
+    if (a->ign)
+	freearray(a->ign);
+    freearray(a->words);
+    if (a->disp)
+	freearray(a->disp);
+    zfree(a, sizeof(struct crcadd));
+}
+
+static void
+freecrcache(Crcache c)
+{
+    Crcadd a, n;
+
+    for (a = c->adds; a; a = n) {
+	n = a->next;
+	freecradd(a);
+    }
+    zsfree(c->list);
+    zsfree(c->insert);
+    zsfree(c->exact);
+    zsfree(c->exactstr);
+    zsfree(c->patinsert);
+    zsfree(c->lastprompt);
+    zsfree(c->toend);
+    zfree(c->key, c->keylen);
+    zsfree(c->prefix);
+    zfree(c, sizeof(struct crcache));
+}
+
+/* Drop the result cache, e.g. when the module is unloaded. */
+
+/**/
+void
+freerescache(void)
+{
+    if (rescache) {
+	freecrcache(rescache);
+	rescache = NULL;
+    }
+}
+
+/* Called when matches are added in a way that can't be recorded. */
+
+/**/
+mod_export void
+nocompcache(void)
+{
+    if (resrec)
+	resrec->bad = 1;
+}
+
+/*
+ * Build the cache key for a call of the completion function fn:
+ * everything the function sees apart from $PREFIX, separated by
+ * null bytes (which can't appear in the metafied strings).
+ */
+
+/**/
+static char *
+crkey(char *fn, int *lenp)
+{
+    char *parts[20], **p, **wp, *key, *k, numbuf[DIGBUFSIZE * 2 + 2];
+    int len = 0, i = 0;
+
+    parts[i++] = fn;
+    parts[i++] = (bindk ? bindk->nam : "");
+    parts[i++] = pwd;
+    parts[i++] = compcontext;
+    parts[i++] = compparameter;
+    parts[i++] = compredirect;
+    parts[i++] = compquote;
+    parts[i++] = compquoting;
+    parts[i++] = compiprefix;
+    parts[i++] = compisuffix;
+    parts[i++] = compqiprefix;
+    parts[i++] = compqisuffix;
+    parts[i++] = compsuffix;
+    parts[i++] = compinsert;
+    parts[i++] = complist;
+    parts[i++] = compvared;
+    sprintf(numbuf, "%ld:%ld", (long)curhist, (long)compcurrent);
+    parts[i++] = numbuf;
+    parts[i] = NULL;
+
+    for (p = parts; *p; p++)
+	len += strlen(*p) + 1;
+    for (p = cfargs; *p; p++)
+	len += strlen(*p) + 1;
+    for (wp = compwords, i = 1; *wp; wp++, i++)
+	if (i != compcurrent)
+	    len += strlen(*wp) + 1;
+
+    k = key = (char *) zalloc(len);
+    for (p = parts; *p; p++)
+	k = strcpy(k, *p) + strlen(*p) + 1;
+    for (p = cfargs; *p; p++)
+	k = strcpy(k, *p) + strlen(*p) + 1;
+    for (wp = compwords, i = 1; *wp; wp++, i++)
+	if (i != compcurrent)
+	    k = strcpy(k, *wp) + strlen(*wp) + 1;
+
+    *lenp = len;
+    return key;
+}
+
+/*
+ * Test if the prefix npre only adds characters to opre that can't
+ * change what the completion function would do with it, e.g. by
+ * starting a new path component or option argument.
+ */
+
+/**/
+static int
+crextends(char *opre, char *npre)
+{
+    if (!strpfx(opre, npre))
+	return 0;
+    npre += strlen(opre);
+    if (!*npre)
+	return 0;
+    for (; *npre; npre++)
+	if ((unsigned char) *npre >= 128 ||
+	    (!ialnum(*npre) && !strchr("-_.+", *npre)))
+	    return 0;
+    return 1;
+}
+
+/*
+ * Start recording the compadd calls for a call of the completion
+ * function.  The key is taken over.
+ */
+
+/**/
+static void
+crstart(char *key, int keylen)
+{
+    resrec = (Crcache) zshcalloc(sizeof(struct crcache));
+    resrec->key = key;
+    resrec->keylen = keylen;
+    resrec->prefix = ztrdup(compprefix);
+}
+
+/*
+ * Remember a compadd call, unless it did something we can't replay.
+ * Only calls that add matches get here.
+ */
+
+static Crcadd
+craddcall(Cadata dat)
+{
+    Crcadd a;
+    char **ign = NULL;
+    int pl = strlen(resrec->prefix), cpl = strlen(compprefix);
+
+    if (!(dat->aflags & CAF_MATCH) || brbeg || brend ||
+	(comppatmatch && *comppatmatch) ||
+	(cpl ? (cpl > pl || strcmp(resrec->prefix + pl - cpl, compprefix))
+	 : pl)) {
+	resrec->bad = 1;
+	return NULL;
+    }
+    if (resplay)
+	ign = resplay->ign;
+    else if (dat->ign)
+	ign = get_user_var(dat->ign);
+
+    a = (Crcadd) zshcalloc(sizeof(struct crcadd));
+    a->dat = *dat;
+    a->dat.ipre = ztrdup(dat->ipre);
+    a->dat.isuf = ztrdup(dat->isuf);
+    a->dat.ppre = ztrdup(dat->ppre);
+    a->dat.psuf = ztrdup(dat->psuf);
+    a->dat.prpre = ztrdup(dat->prpre);
+    a->dat.pre = ztrdup(dat->pre);
+    a->dat.suf = ztrdup(dat->suf);
+    a->dat.group = ztrdup(dat->group);
+    a->dat.rems = ztrdup(dat->rems);
+    a->dat.remf = ztrdup(dat->remf);
+    a->dat.exp = ztrdup(dat->exp);
+    a->dat.mesg = ztrdup(dat->mesg);
+    a->dat.ign = a->dat.disp = NULL;
+    a->dat.aflags &= ~(CAF_ARRAYS | CAF_KEYS);
+    if (a->dat.match)
+	a->dat.match->refc++;
+    a->prefix = ztrdup(compprefix);
+    a->suffix = ztrdup(compsuffix);
+    a->iprefix = ztrdup(compiprefix);
+    a->isuffix = ztrdup(compisuffix);
+    a->qiprefix = ztrdup(compqiprefix);
+    a->qisuffix = ztrdup(compqisuffix);
+    a->quote = ztrdup(compquote);
+    a->exact = ztrdup(compexact);
+    a->ign = (ign ? zarrdup(ign) : NULL);
+    a->words = (char **) zshcalloc((a->szwords = 8) * sizeof(char *));
+
+    if (resrec->lastadd)
+	resrec->lastadd->next = a;
+    else
+	resrec->adds = a;
+    resrec->lastadd = a;
+
+    return a;
+}
+
+/* Remember a word that matched, together with its display string. */
+
+static void
+craddword(Crcadd a, char *s, char **disp)
+{
+    if (a->nwords + 1 == a->szwords)
+	a->words = (char **) zrealloc(a->words,
+				      (a->szwords *= 2) * sizeof(char *));
+    if (disp && a->ndisp == a->nwords) {
+	if (!a->disp)
+	    a->disp = (char **) zshcalloc((a->szdisp = 8) * sizeof(char *));
+	else if (a->ndisp + 1 == a->szdisp)
+	    a->disp = (char **) zrealloc(a->disp,
+					 (a->szdisp *= 2) * sizeof(char *));
+	a->disp[a->ndisp++] = ztrdup(*disp);
+	a->disp[a->ndisp] = NULL;
+    }
+    a->words[a->nwords++] = ztrdup(s);
+    a->words[a->nwords] = NULL;
+}
+
+/*
+ * Try to produce the matches from the cache instead of calling the
+ * completion function.  Returns non-zero if that worked.
+ */
+
+/**/
+static int
+crreplay(void)
+{
+    Crcache c = rescache;
+    Crcadd a;
+    char *extra, *opre, *osuf, *oipre, *oisuf, *oqipre, *oqisuf;
+    char *oquote, *oexact;
+    int onm = mnum;
+
+    if (!c || c->bad || c->keylen != resrec->keylen ||
+	memcmp(c->key, resrec->key, c->keylen) ||
+	!crextends(c->prefix, compprefix))
+	return 0;
+
+    extra = compprefix + strlen(c->prefix);
+    opre = compprefix;
+    osuf = compsuffix;
+    oipre = compiprefix;
+    oisuf = compisuffix;
+    oqipre = compqiprefix;
+    oqisuf = compqisuffix;
+    oquote = compquote;
+    oexact = compexact;
+    NEWHEAPS(compheap) {
+	for (a = c->adds; a && !errflag; a = a->next) {
+	    struct cadata dat = a->dat;
+
+	    compprefix = dyncat(a->prefix, extra);
+	    compsuffix = a->suffix;
+	    compiprefix = a->iprefix;
+	    compisuffix = a->isuffix;
+	    compqiprefix = a->qiprefix;
+	    compqisuffix = a->qisuffix;
+	    compquote = a->quote;
+	    compexact = a->exact;
+	    resplay = a;
+	    addmatches(&dat, arrdup(a->words));
+	    resplay = NULL;
+	}
+    } OLDHEAPS;
+    compprefix = opre;
+    compsuffix = osuf;
+    compiprefix = oipre;
+    compisuffix = oisuf;
+    compqiprefix = oqipre;
+    compqisuffix = oqisuf;
+    compquote = oquote;
+    compexact = oexact;
+
+    if (mnum == onm && !compcancelled) {
+	/*
+	 * Nothing left; call the function after all, it may want
+	 * to try something else when there are no matches.
+	 */
+	Crcadd n;
+
+	for (a = resrec->adds; a; a = n) {
+	    n = a->next;
+	    freecradd(a);
+	}
+	resrec->adds = resrec->lastadd = NULL;
+	resrec->bad = 0;
+	amatches = NULL;
+	nmessages = 0;
+	compignored = 0;
+	hasmatched = hasunmatched = newmatches = 0;
+	begcmgroup("default", 0);
+
+	return 0;
+    }
+    zsfree(complist);
+    complist = ztrdup(c->list);
+    zsfree(compinsert);
+    compinsert = ztrdup(c->insert);
+    zsfree(compexact);
+    compexact = ztrdup(c->exact);
+    zsfree(compexactstr);
+    compexactstr = ztrdup(c->exactstr);
+    zsfree(comppatinsert);
+    comppatinsert = ztrdup(c->patinsert);
+    zsfree(complastprompt);
+    complastprompt = ztrdup(c->lastprompt);
+    zsfree(comptoend);
+    comptoend = ztrdup(c->toend);
+    complistmax = c->listmax;
+
+    return 1;
+}
+
+/*
+ * Finish recording after the completion function (or the cache) has
+ * produced the matches and make the recording the new cache entry if
+ * the function asked for that.  Every other call drops the cache;
+ * setting compstate[cache] to `flush' asks for that explicitly, which
+ * is how a separate widget clears matches the cache would serve.
+ */
+
+/**/
+static void
+crfinish(int hit)
+{
+    Crcache c = resrec;
+
+    resrec = NULL;
+    freerescache();
+    if (c->bad || compcancelled || errflag ||
+	(compcache && !strcmp(compcache, "flush")) ||
+	!(hit || (compcache && !strcmp(compcache, "keep")))) {
+	freecrcache(c);
+	return;
+    }
+    c->list = ztrdup(complist);
+    c->insert = ztrdup(compinsert);
+    c->exact = ztrdup(compexact);
+    c->exactstr = ztrdup(compexactstr);
+    c->patinsert = ztrdup(comppatinsert);
+    c->lastprompt = ztrdup(complastprompt);
+    c->toend = ztrdup(comptoend);
+    c->listmax = complistmax;
+    rescache = c;
+}
+
 /* Before and after hooks called by zle. */
 
 static int oldmenucmp;
@@ -549,8 +1074,9 @@ callcompfunc(char *s, char *fn)
     METACHECK();
 
     if ((shfunc = getshfunc(fn))) {
-	char **p, *tmp;
+	char **p, *tmp, *key;
 	int aadd = 0, usea = 1, icf = incompfunc, osc = sfcontext;
+	int hit, keylen;
 	unsigned int rset, kset;
 	Param *ocrpms = comprpms, *ockpms = compkpms;
 
@@ -810,31 +1336,41 @@ callcompfunc(char *s, char *fn)
 	    compoldlist = compoldins = "";
 	compoldlist = ztrdup(compoldlist);
 	compoldins = ztrdup(compoldins);
-
-	incompfunc = 1;
-	startparamscope();
-	makecompparams();
-	comp_setunset(rset, (~rset & CP_ALLREALS),
-		      kset, (~kset & CP_ALLKEYS));
-	makezleparams(1);
-	sfcontext = SFC_CWIDGET;
-	NEWHEAPS(compheap) {
-	    LinkList largs = NULL;
-
-	    if (*cfargs) {
-		char **p = cfargs;
-
-		largs = newlinklist();
-		addlinknode(largs, dupstring(fn));
-		while (*p)
-		    addlinknode(largs, dupstring(*p++));
-	    }
-	    cfret = doshfunc(shfunc, largs, 1);
-	} OLDHEAPS;
-	sfcontext = osc;
-	endparamscope();
-	lastcmd = 0;
-	incompfunc = icf;
+	zsfree(compcache);
+	compcache = ztrdup("");
+	kset &= ~CP_CACHE;
+
+	key = crkey(fn, &keylen);
+	crstart(key, keylen);
+	if ((hit = crreplay()))
+	    cfret = 0;
+	else {
+	    incompfunc = 1;
+	    startparamscope();
+	    makecompparams();
+	    comp_setunset(rset, (~rset & CP_ALLREALS),
+			  kset, (~kset & CP_ALLKEYS));
+	    makezleparams(1);
+	    sfcontext = SFC_CWIDGET;
+	    NEWHEAPS(compheap) {
+		LinkList largs = NULL;
+
+		if (*cfargs) {
+		    char **p = cfargs;
+
+		    largs = newlinklist();
+		    addlinknode(largs, dupstring(fn));
+		    while (*p)
+			addlinknode(largs, dupstring(*p++));
+		}
+		cfret = doshfunc(shfunc, largs, 1);
+	    } OLDHEAPS;
+	    sfcontext = osc;
+	    endparamscope();
+	    lastcmd = 0;
+	    incompfunc = icf;
+	}
+	crfinish(hit);
 
 	if (!complist)
 	    uselist = 0;
@@ -981,6 +1517,12 @@ makecomplist(char *s, int incmd, int lst)
 	callcompfunc(s, compfunc);
 	endcmgroup(NULL);
 
+	/* Keep whatever was added before a timeout. */
+	if (compcancelint) {
+	    errflag &= ~ERRFLAG_INT;
+	    compcancelint = 0;
+	}
+
 	/* Needed for compcall. */
 	runhookdef(COMPCTLCLEANUPHOOK, NULL);
 
@@ -1019,7 +1561,8 @@ makecomplist(char *s, int incmd, int lst)
 	hasperm = 0;
 	hasoldlist = 1;
 
-	if ((nmatches || nmessages) && !errflag) {
+	if ((nmatches || nmessages) && !errflag &&
+	    compcancelled != COMPCANCEL_TYPEAHEAD) {
 	    validlist = 1;
 
 	    redup(osi, 0);
@@ -2041,6 +2584,14 @@ addmatches(Cadata dat, char **argv)
     LinkList aparl = NULL, oparl = NULL, dparl = NULL;
     Brinfo bp, bpl = brbeg, obpl, bsl = brend, obsl;
     Heap oldheap;
+    unsigned int nadded = 0;
+    Crcadd cra = NULL;
+    Cmfilter mf = NULL;
+
+    if (compcheckcancel())
+	return 1;
+    if (resrec && !resrec->bad && !dat->apar && !dat->opar && !dat->dpar)
+	cra = craddcall(dat);
 
     SWITCHHEAPS(oldheap, compheap) {
         if (dat->dummies >= 0)
@@ -2150,7 +2701,11 @@ addmatches(Cadata dat, char **argv)
 	    update_bmatchers();
 
 	/* Get the suffixes to ignore. */
-	if (dat->ign && (aign = get_user_var(dat->ign))) {
+	if (resplay)
+	    aign = (resplay->ign ? arrdup(resplay->ign) : NULL);
+	else if (dat->ign)
+	    aign = get_user_var(dat->ign);
+	if (aign) {
 	    char **ap, **sp, *tmp;
 	    Patprog *pp, prog;
 
@@ -2174,7 +2729,10 @@ addmatches(Cadata dat, char **argv)
 		pign = NULL;
 	}
 	/* Get the display strings. */
-	if (dat->disp)
+	if (resplay) {
+	    if (resplay->disp)
+		disp = arrdup(resplay->disp) - 1;
+	} else if (dat->disp)
 	    if ((disp = get_user_var(dat->disp)))
 		disp--;
 	/* Get the contents of the completion variables if we have
@@ -2380,6 +2938,8 @@ addmatches(Cadata dat, char **argv)
 			tildequote(lpre, 1) : multiquote(lpre, 1));
 	    if (lsuf)
 		lsuf = multiquote(lsuf, 1);
+	    if (lpre && !cp)
+		mf = get_cmfilter(lpre);
 	}
 	/* Walk through the matches given. */
 	obpl = bpl;
@@ -2407,6 +2967,8 @@ addmatches(Cadata dat, char **argv)
 	if (dat->psuf)
 	    psl = strlen(dat->psuf);
 	for (; (s = *argv); argv++) {
+	    if (!(++nadded & 255) && compcheckcancel())
+		break;
 	    bpl = obpl;
 	    bsl = obsl;
 	    if (disp) {
@@ -2444,6 +3006,8 @@ addmatches(Cadata dat, char **argv)
 		}
 		if (!addit) {
 		    compignored++;
+		    if (cra)
+			craddword(cra, s, disp);
 		    if (dparr && !*++dparr)
 			dparr = NULL;
 		    goto next_array;
@@ -2456,7 +3020,8 @@ addmatches(Cadata dat, char **argv)
 		    sl = strlen(ms = multiquote(s, 0));
 		lc = bld_parts(ms, sl, -1, NULL, NULL);
 		isexact = 0;
-	    } else if (!(ms = comp_match(lpre, lsuf, s, cp, &lc,
+	    } else if ((mf && cmfilter_rejects(mf, s)) ||
+		       !(ms = comp_match(lpre, lsuf, s, cp, &lc,
 					 (!(dat->aflags & CAF_QUOTE) ?
 					  (dat->ppre ||
 					   !(dat->flags & CMF_FILE) ? 1 : 2) : 0),
@@ -2466,6 +3031,8 @@ addmatches(Cadata dat, char **argv)
 		    dparr = NULL;
 		goto next_array;
 	    }
+	    if (cra)
+		craddword(cra, s, disp);
 	    if (doadd) {
 		Brinfo bp;
 
@@ -2910,6 +3477,7 @@ add_match_data(int alt, char *str, char *orig, Cline line,
     cm->qisl = qisl;
     cm->autoq = dupstring(autoq ? autoq : (inbackt ? "`" : NULL));
     cm->rems = cm->remf = cm->disp = NULL;
+    cm->perm = NULL;
 
     if ((lastprebr || lastpostbr) && !hasbrpsfx(cm, lastprebr, lastpostbr))
 	return NULL;
@@ -3253,57 +3821,199 @@ makearray(LinkList l, int type, int flags, int *np, int *nlp, int *llp)
     return rp;
 }
 
-/* This duplicates one match. */
+/*
+ * Permanent copies of matches.  All new matches of a group are copied
+ * into a single arena.  The prefixes and suffixes are normally the same
+ * for long runs of matches, so a string equal to the one stored last
+ * for the same field is only stored once; the unquoted string is shared
+ * with the match itself when they are equal.
+ */
+
+struct cmintern {
+    char *src, *dst;
+};
+
+#define CMI_IPRE    0
+#define CMI_RIPRE   1
+#define CMI_ISUF    2
+#define CMI_PPRE    3
+#define CMI_PSUF    4
+#define CMI_PRPRE   5
+#define CMI_PRE     6
+#define CMI_SUF     7
+#define CMI_REMS    8
+#define CMI_REMF    9
+#define CMI_AUTOQ  10
+#define CMI_DISP   11
+#define CMI_COUNT  12
+
+/*
+ * Store a string in the arena at *memp, unless it equals the last one
+ * stored via ci.  Without an arena only the space needed is added up.
+ */
+
+static char *
+permstr(struct cmintern *ci, char *s, char **memp, size_t *lenp)
+{
+    size_t l;
+
+    if (!s)
+	return NULL;
+    if (ci->src && (s == ci->src || !strcmp(s, ci->src))) {
+	ci->src = s;
+	return ci->dst;
+    }
+    ci->src = s;
+    l = strlen(s) + 1;
+    if (*memp) {
+	ci->dst = (char *) memcpy(*memp, s, l);
+	*memp += l;
+    } else
+	*lenp += l;
+
+    return ci->dst;
+}
+
+/* Copy or size the strings of one match; r is NULL when sizing. */
+
+static void
+permmatchstrs(Cmatch r, Cmatch m, struct cmintern *ci, char **memp,
+	      size_t *lenp)
+{
+    struct cmatch dummy;
+    struct cmintern str;
+
+    if (!r)
+	r = &dummy;
+    str.src = str.dst = NULL;
+    r->str = permstr(&str, m->str, memp, lenp);
+    r->orig = permstr(&str, m->orig, memp, lenp);
+    r->ipre = permstr(ci + CMI_IPRE, m->ipre, memp, lenp);
+    r->ripre = permstr(ci + CMI_RIPRE, m->ripre, memp, lenp);
+    r->isuf = permstr(ci + CMI_ISUF, m->isuf, memp, lenp);
+    r->ppre = permstr(ci + CMI_PPRE, m->ppre, memp, lenp);
+    r->psuf = permstr(ci + CMI_PSUF, m->psuf, memp, lenp);
+    r->prpre = permstr(ci + CMI_PRPRE, m->prpre, memp, lenp);
+    r->pre = permstr(ci + CMI_PRE, m->pre, memp, lenp);
+    r->suf = permstr(ci + CMI_SUF, m->suf, memp, lenp);
+    r->rems = permstr(ci + CMI_REMS, m->rems, memp, lenp);
+    r->remf = permstr(ci + CMI_REMF, m->remf, memp, lenp);
+    r->autoq = permstr(ci + CMI_AUTOQ, m->autoq, memp, lenp);
+    r->disp = permstr(ci + CMI_DISP, m->disp, memp, lenp);
+}
+
+/* Return the arena of a group that holds the match m, if any. */
+
+static int
+cmarenaidx(Cmgroup g, Cmatch m)
+{
+    int i;
+
+    if (g && m)
+	for (i = 0; i < g->narenas; i++)
+	    if ((char *) m >= g->arenas[i]->mem &&
+		(char *) m < g->arenas[i]->mem + g->arenas[i]->size)
+		return i;
+    return -1;
+}
 
 /**/
-static Cmatch
-dupmatch(Cmatch m, int nbeg, int nend)
+static void
+freecmarena(Cmarena a)
 {
-    Cmatch r;
-
-    r = (Cmatch) zshcalloc(sizeof(struct cmatch));
-
-    r->str = ztrdup(m->str);
-    r->orig = ztrdup(m->orig);
-    r->ipre = ztrdup(m->ipre);
-    r->ripre = ztrdup(m->ripre);
-    r->isuf = ztrdup(m->isuf);
-    r->ppre = ztrdup(m->ppre);
-    r->psuf = ztrdup(m->psuf);
-    r->prpre = ztrdup(m->prpre);
-    r->pre = ztrdup(m->pre);
-    r->suf = ztrdup(m->suf);
-    r->flags = m->flags;
-    if (m->brpl) {
-	int *p, *q, i;
-
-	r->brpl = (int *) zalloc(nbeg * sizeof(int));
-
-	for (p = r->brpl, q = m->brpl, i = nbeg; i--; p++, q++)
-	    *p = *q;
-    } else
-	r->brpl = NULL;
-    if (m->brsl) {
-	int *p, *q, i;
+    if (!--a->refc) {
+	if (a->all)
+	    zsfree(a->all->disp);
+	zfree(a->mem, a->size);
+	zfree(a, sizeof(struct cmarena));
+    }
+}
 
-	r->brsl = (int *) zalloc(nend * sizeof(int));
+/*
+ * Fill the array of permanent matches p of the new group n from the
+ * heap matches q.  Matches already copied for o, the old permanent
+ * version of the group, are shared with it instead of copied again.
+ */
 
-	for (p = r->brsl, q = m->brsl, i = nend; i--; p++, q++)
-	    *p = *q;
-    } else
-	r->brsl = NULL;
-    r->rems = ztrdup(m->rems);
-    r->remf = ztrdup(m->remf);
-    r->autoq = ztrdup(m->autoq);
-    r->qipl = m->qipl;
-    r->qisl = m->qisl;
-    r->disp = ztrdup(m->disp);
-    r->mode = m->mode;
-    r->modec = m->modec;
-    r->fmode = m->fmode;
-    r->fmodec = m->fmodec;
+/**/
+static void
+permgroupmatches(Cmgroup n, Cmgroup o, Cmatch *q, Cmatch *p, int nbeg, int nend)
+{
+    struct cmintern ci[CMI_COUNT];
+    Cmatch *mp, m, r = NULL;
+    Cmarena a = NULL;
+    char *mem = NULL, *nomem = NULL;
+    int *ip = NULL, *used = NULL, count = 0, nints = 0, i, j;
+    size_t len = 0;
+
+    if (o && o->narenas)
+	used = (int *) zhalloc(o->narenas * sizeof(int));
+    for (i = 0; o && i < o->narenas; i++)
+	used[i] = 0;
+
+    /* First find out what we have to copy and how much space it needs. */
+    memset(ci, 0, sizeof(ci));
+    for (mp = q; (m = *mp); mp++) {
+	if ((i = cmarenaidx(o, m->perm)) >= 0) {
+	    used[i] = 1;
+	    continue;
+	}
+	count++;
+	if (m->brpl)
+	    nints += nbeg;
+	if (m->brsl)
+	    nints += nend;
+	permmatchstrs(NULL, m, ci, &nomem, &len);
+    }
 
-    return r;
+    n->narenas = (count ? 1 : 0);
+    for (i = 0; o && i < o->narenas; i++)
+	if (used[i])
+	    n->narenas++;
+    n->arenas = (n->narenas ?
+		 (Cmarena *) zalloc(n->narenas * sizeof(Cmarena)) : NULL);
+    for (i = j = 0; o && i < o->narenas; i++)
+	if (used[i]) {
+	    n->arenas[j++] = o->arenas[i];
+	    o->arenas[i]->refc++;
+	}
+    if (count) {
+	a = n->arenas[j] = (Cmarena) zalloc(sizeof(struct cmarena));
+	a->refc = 1;
+	a->all = NULL;
+	a->size = (count * sizeof(struct cmatch) + nints * sizeof(int) + len);
+	a->mem = (char *) zalloc(a->size);
+	r = (Cmatch) a->mem;
+	ip = (int *) (r + count);
+	mem = (char *) (ip + nints);
+    }
+    /* Now copy. */
+    memset(ci, 0, sizeof(ci));
+    for (mp = q; (m = *mp); mp++, p++) {
+	if (cmarenaidx(o, m->perm) >= 0) {
+	    *p = m->perm;
+	    (*p)->flags = m->flags;
+	    continue;
+	}
+	*r = *m;
+	permmatchstrs(r, m, ci, &mem, &len);
+	if (m->flags & CMF_ALL) {
+	    /* bld_all_str() replaces the display string when listing */
+	    r->disp = ztrdup(m->disp);
+	    a->all = r;
+	}
+	if (m->brpl) {
+	    r->brpl = (int *) memcpy(ip, m->brpl, nbeg * sizeof(int));
+	    ip += nbeg;
+	}
+	if (m->brsl) {
+	    r->brsl = (int *) memcpy(ip, m->brsl, nend * sizeof(int));
+	    ip += nend;
+	}
+	r->perm = NULL;
+	*p = m->perm = r++;
+    }
+    *p = NULL;
 }
 
 /* This duplicates all groups of matches. */
@@ -3312,9 +4022,9 @@ dupmatch(Cmatch m, int nbeg, int nend)
 mod_export int
 permmatches(int last)
 {
-    Cmgroup g = amatches, n;
+    Cmgroup g = amatches, n, o;
     Cmatch *p, *q;
-    Cexpl *ep, *eq, e, o;
+    Cexpl *ep, *eq, e, oe;
     LinkList mlist;
     static int fi = 0;
     int nn, nl, ll, gn = 1, mn = 1, rn, ofi = fi;
@@ -3372,10 +4082,7 @@ permmatches(int last)
 	    n->heap_id = HEAPID_PERMANENT;
 #endif
 
-	    if (g->perm) {
-		g->perm->next = NULL;
-		freematches(g->perm, 0);
-	    }
+	    o = g->perm;
 	    g->perm = n;
 
 	    if (!lmatches)
@@ -3388,11 +4095,13 @@ permmatches(int last)
 	    n->num = gn++;
 	    n->flags = g->flags;
 	    n->mcount = g->mcount;
-	    n->matches = p = (Cmatch *) zshcalloc((n->mcount + 1) * sizeof(Cmatch));
+	    n->matches = (Cmatch *) zshcalloc((n->mcount + 1) * sizeof(Cmatch));
 	    n->name = ztrdup(g->name);
-	    for (q = g->matches; *q; q++, p++)
-		*p = dupmatch(*q, nbrbeg, nbrend);
-	    *p = NULL;
+	    permgroupmatches(n, o, g->matches, n->matches, nbrbeg, nbrend);
+	    if (o) {
+		o->next = NULL;
+		freematches(o, 0);
+	    }
 
 	    n->lcount = g->lcount;
 	    n->llcount = g->llcount;
@@ -3403,12 +4112,12 @@ permmatches(int last)
 
 	    if ((n->ecount = g->ecount)) {
 		n->expls = ep = (Cexpl *) zshcalloc((n->ecount + 1) * sizeof(Cexpl));
-		for (eq = g->expls; (o = *eq); eq++, ep++) {
+		for (eq = g->expls; (oe = *eq); eq++, ep++) {
 		    *ep = e = (Cexpl) zshcalloc(sizeof(struct cexpl));
-		    e->count = (fi ? o->fcount : o->count);
-                    e->always = o->always;
+		    e->count = (fi ? oe->fcount : oe->count);
+                    e->always = oe->always;
 		    e->fcount = 0;
-		    e->str = ztrdup(o->str);
+		    e->str = ztrdup(oe->str);
 		}
 		*ep = NULL;
 	    } else
@@ -3458,36 +4167,6 @@ permmatches(int last)
     return fi;
 }
 
-/* This frees one match. */
-
-/**/
-static void
-freematch(Cmatch m, int nbeg, int nend)
-{
-    if (!m) return;
-
-    zsfree(m->str);
-    zsfree(m->orig);
-    zsfree(m->ipre);
-    zsfree(m->ripre);
-    zsfree(m->isuf);
-    zsfree(m->ppre);
-    zsfree(m->psuf);
-    zsfree(m->pre);
-    zsfree(m->suf);
-    zsfree(m->prpre);
-    zsfree(m->rems);
-    zsfree(m->remf);
-    zsfree(m->disp);
-    zsfree(m->autoq);
-    if (m->brpl)
-	zfree(m->brpl, nbeg * sizeof(int));
-    if (m->brsl)
-	zfree(m->brsl, nend * sizeof(int));
-
-    zfree(m, sizeof(*m));
-}
-
 /* This frees the groups of matches. */
 
 /**/
@@ -3495,14 +4174,16 @@ mod_export void
 freematches(Cmgroup g, int cm)
 {
     Cmgroup n;
-    Cmatch *m;
     Cexpl *e;
+    int i;
 
     while (g) {
 	n = g->next;
 
-	for (m = g->matches; *m; m++)
-	    freematch(*m, g->nbrbeg, g->nbrend);
+	for (i = 0; i < g->narenas; i++)
+	    freecmarena(g->arenas[i]);
+	if (g->arenas)
+	    zfree(g->arenas, g->narenas * sizeof(Cmarena));
 	free(g->matches);
 
 	if (g->ylist)
@@ -1671,6 +1671,7 @@ bin_compcall(char *name, UNUSED(char **argv), Options ops, UNUSED(int func))
 	zwarnnam(name, "can only be called from completion function");
 	return 1;
     }
+    nocompcache();
     return makecomplistctl((OPT_ISSET(ops,'T') ? 0 : CFN_FIRST) |
 			   (OPT_ISSET(ops,'D') ? 0 : CFN_DEFAULT));
 }
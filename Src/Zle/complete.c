@@ -70,7 +70,8 @@ char *compiprefix,
      *comptoend,
      *compoldlist,
      *compoldins,
-     *compvared;
+     *compvared,
+     *compcache;
 
 /**/
 Param *comprpms, *compkpms;
@@ -1172,6 +1173,7 @@ static struct compparam compkparams[] = {
     { "list_lines", PM_INTEGER | PM_READONLY, NULL, GSU(listlines_gsu) },
     { "all_quotes", PM_SCALAR | PM_READONLY, NULL, GSU(compqstack_gsu) },
     { "ignored", PM_INTEGER | PM_READONLY, VAL(compignored), NULL },
+    { "cache", PM_SCALAR, VAL(compcache), NULL },
     { NULL, 0, NULL, NULL }
 };
 
@@ -1610,7 +1612,7 @@ setup_(UNUSED(Module m))
 	compquoting = comprestore = complist = compinsert =
 	compexact = compexactstr = comppatmatch = comppatinsert =
 	complastprompt = comptoend = compoldlist = compoldins =
-	compvared = compqstack = NULL;
+	compvared = compqstack = compcache = NULL;
     complastprefix = ztrdup("");
     complastsuffix = ztrdup("");
     complistmax = 0;
@@ -1698,6 +1700,8 @@ finish_(UNUSED(Module m))
     zsfree(compoldlist);
     zsfree(compoldins);
     zsfree(compvared);
+    zsfree(compcache);
+    freerescache();
 
     hascompmod = 0;
 
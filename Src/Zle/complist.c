@@ -1341,12 +1341,82 @@ compzputs(char const *s, int ml)
     return 0;
 }
 
+/*
+ * Places in the list at which compprintlist() can resume walking the
+ * groups, remembered about every CLSEEK_STEP lines while the list is
+ * shown in menu selection.  When scrolling to a line far down a long
+ * list we then only need to step over the matches from the nearest
+ * such place above it instead of over all of them from the top.  The
+ * fields are those of the single resume position kept in
+ * compprintlist().
+ */
+
+struct clseek {
+    int type, ml, n, nl;
+    Cmgroup g;
+    Cmatch *p;
+    Cexpl *e;
+};
+
+#define CLSEEK_STEP 16
+
+static struct clseek *clseeks;
+static int nclseeks, szclseeks;
+
+static void
+addclseek(int type, int ml, Cmgroup g, Cmatch *p, Cexpl *e, int n, int nl)
+{
+    struct clseek *s;
+
+    if (ml < (nclseeks ? clseeks[nclseeks - 1].ml : 0) + CLSEEK_STEP)
+	return;
+    if (nclseeks == szclseeks) {
+	int nsz = (szclseeks ? 2 * szclseeks : 64);
+
+	clseeks = (struct clseek *)
+	    zrealloc(clseeks, nsz * sizeof(struct clseek));
+	szclseeks = nsz;
+    }
+    s = clseeks + nclseeks++;
+    s->type = type;
+    s->ml = ml;
+    s->g = g;
+    s->p = p;
+    s->e = e;
+    s->n = n;
+    s->nl = nl;
+}
+
+/*
+ * Find the last remembered place above line ml.  It has to be strictly
+ * above it so that the line break leading into ml is still done in the
+ * normal way and counted for clearing the rest of the screen.
+ */
+
+static struct clseek *
+findclseek(int ml)
+{
+    int lo = 0, hi = nclseeks;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (clseeks[mid].ml < ml)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return (lo ? clseeks + lo - 1 : NULL);
+}
+
 /**/
 static int
 compprintlist(int showall)
 {
     static int lasttype = 0, lastbeg = 0, lastml = 0, lastinvcount = -1;
     static int lastn = 0, lastnl = 0, lastnlnct = -1;
+    static int seekshowall = -1, seeklines = -1, seekcols = -1;
+    static Cmgroup seekmatches = NULL;
     static Cmgroup lastg = NULL;
     static Cmatch *lastp = NULL;
     static Cexpl *lastexpl = NULL;
@@ -1358,12 +1428,33 @@ compprintlist(int showall)
     int lastused = 0;
 
     mfirstl = -1;
+    if (mnew || lastinvcount != invcount || seekshowall != showall ||
+	seekmatches != amatches || seeklines != listdat.nlines ||
+	seekcols != zterm_columns) {
+	nclseeks = 0;
+	seekshowall = showall;
+	seekmatches = amatches;
+	seeklines = listdat.nlines;
+	seekcols = zterm_columns;
+    }
     if (mnew || lastinvcount != invcount || lastbeg != mlbeg || mlbeg < 0) {
+	struct clseek *s;
+
 	lasttype = 0;
 	lastg = NULL;
 	lastexpl = NULL;
 	lastml = 0;
 	lastnlnct = -1;
+	if (!mnew && mlbeg > 0 && (s = findclseek(mlbeg))) {
+	    lasttype = s->type;
+	    lastg = s->g;
+	    lastbeg = mlbeg;
+	    lastml = s->ml;
+	    lastexpl = s->e;
+	    lastp = s->p;
+	    lastn = s->n;
+	    lastnl = s->nl;
+	}
     }
     cl = (listdat.nlines > zterm_lines - nlnct - mhasstat ?
 	  zterm_lines - nlnct - mhasstat :
@@ -1388,7 +1479,7 @@ compprintlist(int showall)
 	    HEAP_ERROR(g->heap_id);
 	}
 #endif
-	if ((e = g->expls)) {
+	if ((e = g->expls) && (lastused || lasttype < 2)) {
 	    if (!lastused && lasttype == 1) {
 		e = lastexpl;
 		ml = lastml;
@@ -1425,6 +1516,8 @@ compprintlist(int showall)
 		    }
 		    if (stop)
 			goto end;
+		    if (mlbeg >= 0)
+			addclseek(1, ml, g, NULL, e, 0, 0);
 		    if (!lasttype && ml >= mlbeg) {
 			lasttype = 1;
 			lastg = g;
@@ -1539,6 +1632,8 @@ compprintlist(int showall)
 				    tcout(TCCLEAREOD);
 			    }
 			}
+			if (mlbeg >= 0)
+			    addclseek(2, ml, g, p, NULL, n, nl);
 			if (!lasttype && ml >= mlbeg) {
 			    lasttype = 2;
 			    lastg = g;
@@ -1588,6 +1683,8 @@ compprintlist(int showall)
 		p = skipnolist(g->matches, showall);
 
 	    while (n && nl-- && !errflag) {
+		if (mlbeg >= 0)
+		    addclseek(3, ml, g, p, NULL, n, nl + 1);
 		if (!lasttype && ml >= mlbeg) {
 		    lasttype = 3;
 		    lastg = g;
@@ -3560,6 +3657,9 @@ cleanup_(Module m)
 {
     free(mtab);
     free(mgtab);
+    zfree(clseeks, szclseeks * sizeof(struct clseek));
+    clseeks = NULL;
+    nclseeks = szclseeks = 0;
 
     deletezlefunction(w_menuselect);
     deletehookfunc("comp_list_matches", (Hookfn) complistmatches);
@@ -1006,6 +1006,98 @@ match_parts(char *l, char *w, int n, int part)
     return ret;
 }
 
+/* Non-zero if quoting never changes the character c and nothing is
+ * ever inserted in front of it when quoting a word. */
+
+static int
+cmfilter_plain(int c)
+{
+    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9') ||
+	    c == '_' || c == '.' || c == '/' || c == '-' || c == '+');
+}
+
+/* Build the filter for the line prefix pfx (already quoted) and the
+ * matchers currently on the stack.  This is done once per compadd so
+ * that the test for every single word is only a few comparisons.
+ * With matchers the filter is only used if all of them map exactly
+ * one line character to one word character without anchors (like
+ * `m:{a-z}={A-Z}'); everything else can shift the positions in the
+ * word and we just let comp_match() do the work.  Returns NULL if
+ * the filter would never reject anything. */
+
+/**/
+mod_export Cmfilter
+get_cmfilter(char *pfx)
+{
+    Cmfilter f;
+    Cmlist ms;
+    Cmatcher mp;
+    int len, i, c, mt;
+
+    for (len = 0; cmfilter_plain(STOUC(pfx[len])); len++);
+    if (!len)
+	return NULL;
+
+    for (ms = mstack; ms; ms = ms->next)
+	for (mp = ms->matcher; mp; mp = mp->next)
+	    if ((mp->flags & (CMF_LEFT | CMF_RIGHT)) ||
+		mp->llen != 1 || mp->wlen != 1 || !mp->line || !mp->word)
+		return NULL;
+
+    f = (Cmfilter) zhalloc(sizeof(struct cmfilter));
+    f->pfx = pfx;
+    f->len = len;
+    f->allow = NULL;
+
+    if (mstack) {
+	unsigned char *a;
+
+	f->allow = a = (unsigned char *) hcalloc(len * 16);
+	for (i = 0; i < len; i++, a += 16) {
+	    c = STOUC(pfx[i]);
+	    a[c >> 3] |= 1 << (c & 7);
+	    for (ms = mstack; ms; ms = ms->next)
+		for (mp = ms->matcher; mp; mp = mp->next)
+		    if (pattern_match1(mp->line, c, &mt)) {
+			int wc;
+
+			/* Ignoring the correspondence in equivalence
+			 * classes gives us a superset, that's fine. */
+			for (wc = 1; wc < 128; wc++)
+			    if (pattern_match1(mp->word, wc, &mt))
+				a[wc >> 3] |= 1 << (wc & 7);
+		    }
+	}
+    }
+    return f;
+}
+
+/* Return non-zero if the (unquoted) word w can't be matched by the
+ * prefix the filter f was built for.  Any character we aren't sure
+ * about (one that is changed by quoting, a backslash, a multibyte
+ * character) makes us give up and leave it to comp_match(). */
+
+/**/
+mod_export int
+cmfilter_rejects(Cmfilter f, char *w)
+{
+    unsigned char *a = f->allow;
+    int i, c;
+
+    if (!a && !strncmp(w, f->pfx, f->len))
+	return 0;
+
+    for (i = 0; i < f->len; i++, w++) {
+	c = STOUC(*w);
+	if (c == STOUC(f->pfx[i]) ||
+	    (a && c < 128 && (a[i * 16 + (c >> 3)] & (1 << (c & 7)))))
+	    continue;
+	return (!c || cmfilter_plain(c));
+    }
+    return 0;
+}
+
 /* Check if the word w is matched by the strings in pfx and sfx (the prefix
  * and the suffix from the line) or the pattern cp. In clp a cline list for
  * w is returned.
@@ -910,7 +910,6 @@ struct cadef {
     Caarg rest;			/* the rest-argument */
     char **defs;		/* the original strings */
     int ndefs;			/* number of ... */
-    int lastt;			/* last time this was used */
     Caopt *single;		/* array of single-letter options */
     char *match;		/* -M spec to use */
     int argsactive;		/* if arguments are still allowed */
@@ -967,11 +966,6 @@ struct caarg {
 #define CAA_RARGS  4
 #define CAA_RREST  5
 
-/* The cache of parsed descriptons. */
-
-#define MAX_CACACHE 8
-static Cadef cadef_cache[MAX_CACACHE];
-
 /* Compare two arrays of strings for equality. */
 
 static int
@@ -990,6 +984,185 @@ arrcmp(char **a, char **b)
     }
 }
 
+/*
+ * Caches of parsed descriptions for _arguments and _values.  Parsing
+ * the specs for some commands is expensive, so every parsed definition
+ * is remembered, hashed on the array of spec strings it was built
+ * from.  The entries are kept in a list with the most recently used
+ * first; when there are more than max of them the ones at the end are
+ * thrown away.  The size can be set and the counters can be shown with
+ * `comparguments -c' and `compvalues -c'.
+ */
+
+typedef struct defcache *Defcache;
+typedef struct defent *Defent;
+
+struct defent {
+    Defent hnext;		/* next in hash chain */
+    Defent prev, next;		/* neighbours in LRU list */
+    unsigned int hash;		/* hash value for defs */
+    char **defs;		/* the spec strings (owned by def) */
+    int ndefs;			/* number of ... */
+    void *def;			/* the Cadef or Cvdef */
+};
+
+struct defcache {
+    Defent *htab;		/* hash table */
+    int hsize;			/* number of slots in htab */
+    Defent first, last;		/* LRU list, most recently used first */
+    int count;			/* number of entries */
+    int max;			/* maximum number of entries */
+    long hits, misses, evictions;
+};
+
+#define DEFCACHE_SIZE 64
+
+static unsigned int
+defcache_hash(char **a)
+{
+    unsigned int h = 0;
+
+    for (; *a; a++)
+	h = h * 31 + hasher(*a);
+
+    return h;
+}
+
+static void
+defcache_unlink(Defcache c, Defent e)
+{
+    if (e->prev)
+	e->prev->next = e->next;
+    else
+	c->first = e->next;
+    if (e->next)
+	e->next->prev = e->prev;
+    else
+	c->last = e->prev;
+}
+
+static void
+defcache_push(Defcache c, Defent e)
+{
+    e->prev = NULL;
+    if ((e->next = c->first))
+	e->next->prev = e;
+    else
+	c->last = e;
+    c->first = e;
+}
+
+/* Look up the definition for the specs in args; on a hit it becomes
+ * the most recently used one. */
+
+static void *
+defcache_get(Defcache c, char **args)
+{
+    Defent e;
+    unsigned int h;
+    int na;
+
+    if (c->htab) {
+	h = defcache_hash(args);
+	na = arrlen(args);
+	for (e = c->htab[h % c->hsize]; e; e = e->hnext)
+	    if (e->hash == h && e->ndefs == na && arrcmp(args, e->defs)) {
+		c->hits++;
+		if (e != c->first) {
+		    defcache_unlink(c, e);
+		    defcache_push(c, e);
+		}
+		return e->def;
+	    }
+    }
+    c->misses++;
+
+    return NULL;
+}
+
+/* Remove the least recently used entry if there are more than max
+ * entries and return its definition for the caller to free. */
+
+static void *
+defcache_trim(Defcache c, int max)
+{
+    Defent e = c->last, *ep;
+    void *def;
+
+    if (c->count <= max || !e)
+	return NULL;
+
+    for (ep = c->htab + (e->hash % c->hsize); *ep != e; ep = &(*ep)->hnext);
+    *ep = e->hnext;
+    defcache_unlink(c, e);
+    c->count--;
+    def = e->def;
+    zfree(e, sizeof(*e));
+
+    return def;
+}
+
+/* Add a new definition; the caller has to use defcache_trim() to get
+ * rid of old ones afterwards. */
+
+static void
+defcache_add(Defcache c, char **defs, void *def)
+{
+    Defent e = (Defent) zalloc(sizeof(*e));
+    int slot;
+
+    if (c->count >= 2 * c->hsize) {
+	/* Grow the table, re-hashing the entries. */
+	int nsize = (c->hsize ? 4 * c->hsize : 32);
+	Defent *ntab = (Defent *) zshcalloc(nsize * sizeof(Defent)), o;
+
+	for (o = c->first; o; o = o->next) {
+	    slot = o->hash % nsize;
+	    o->hnext = ntab[slot];
+	    ntab[slot] = o;
+	}
+	if (c->htab)
+	    zfree(c->htab, c->hsize * sizeof(Defent));
+	c->htab = ntab;
+	c->hsize = nsize;
+    }
+    e->defs = defs;
+    e->ndefs = arrlen(defs);
+    e->hash = defcache_hash(defs);
+    e->def = def;
+    slot = e->hash % c->hsize;
+    e->hnext = c->htab[slot];
+    c->htab[slot] = e;
+    defcache_push(c, e);
+    c->count++;
+}
+
+/* Handle the -c option of comparguments and compvalues: set the size
+ * of the cache (and reset the counters) if a number is given,
+ * otherwise print the counters. */
+
+static int
+defcache_opt(char *nam, Defcache c, char *arg)
+{
+    if (arg) {
+	char *end;
+	zlong n = zstrtol(arg, &end, 10);
+
+	if (*end || n < 1 || n > INT_MAX) {
+	    zwarnnam(nam, "invalid cache size: %s", arg);
+	    return 1;
+	}
+	c->max = (int) n;
+	c->hits = c->misses = c->evictions = 0;
+    } else
+	printf("size %d entries %d hits %ld misses %ld evictions %ld\n",
+	       c->max, c->count, c->hits, c->misses, c->evictions);
+
+    return 0;
+}
+
+static struct defcache cadef_cache;
+
 /* Memory stuff. Obviously. */
 
 static void
@@ -1146,7 +1319,6 @@ alloc_cadef(char **args, int single, char *match, char *nonarg, int flags)
 	ret->defs = NULL;
 	ret->ndefs = 0;
     }
-    ret->lastt = time(0);
     ret->set = ret->sname = NULL;
     if (single) {
 	ret->single = (Caopt *) zalloc(256 * sizeof(Caopt));
@@ -1643,21 +1815,16 @@ parse_cadef(char *nam, char **args)
 static Cadef
 get_cadef(char *nam, char **args)
 {
-    Cadef *p, *min, new;
-    int i, na = arrlen(args);
-
-    for (i = MAX_CACACHE, p = cadef_cache, min = NULL; i && *p; p++, i--)
-	if (*p && na == (*p)->ndefs && arrcmp(args, (*p)->defs)) {
-	    (*p)->lastt = time(0);
-
-	    return *p;
-	} else if (!min || !*p || (*p)->lastt < (*min)->lastt)
-	    min = p;
-    if (i > 0)
-	min = p;
+    Cadef new, old;
+
+    if ((new = (Cadef) defcache_get(&cadef_cache, args)))
+	return new;
     if ((new = parse_cadef(nam, args))) {
-	freecadef(*min);
-	*min = new;
+	defcache_add(&cadef_cache, new->defs, new);
+	while ((old = (Cadef) defcache_trim(&cadef_cache, cadef_cache.max))) {
+	    cadef_cache.evictions++;
+	    freecadef(old);
+	}
     }
     return new;
 }
@@ -2463,6 +2630,23 @@ bin_comparguments(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
     int min, max, n;
     Castate lstate = &ca_laststate;
 
+    if (!strcmp(args[0], "-c")) {
+	/* Cache control, allowed outside completion functions. */
+	Cadef old;
+
+	if (args[1] && args[2]) {
+	    zwarnnam(nam, "too many arguments");
+	    return 1;
+	}
+	if (defcache_opt(nam, &cadef_cache, args[1]))
+	    return 1;
+	while ((old = (Cadef) defcache_trim(&cadef_cache, cadef_cache.max))) {
+	    /* The parsed state may point into it. */
+	    ca_parsed = 0;
+	    freecadef(old);
+	}
+	return 0;
+    }
     if (incompfunc != 1) {
 	zwarnnam(nam, "can only be called from completion function");
 	return 1;
@@ -2813,7 +2997,6 @@ struct cvdef {
     Cvval vals;			/* value definitions */
     char **defs;		/* original strings */
     int ndefs;			/* number of ... */
-    int lastt;			/* last time used */
     int words;                  /* if to look at other words */
 };
 
@@ -2833,10 +3016,9 @@ struct cvval {
 #define CVV_ARG   1
 #define CVV_OPT   2
 
-/* Cache. */
+/* Cache, see defcache above. */
 
-#define MAX_CVCACHE 8
-static Cvdef cvdef_cache[MAX_CVCACHE];
+static struct defcache cvdef_cache;
 
 /* Memory stuff. */
 
@@ -2906,7 +3088,6 @@ parse_cvdef(char *nam, char **args)
     ret->vals = NULL;
     ret->defs = zarrdup(oargs);
     ret->ndefs = arrlen(oargs);
-    ret->lastt = time(0);
     ret->words = words;
 
     for (valp = &(ret->vals); *args; args++) {
@@ -3032,21 +3213,16 @@ parse_cvdef(char *nam, char **args)
 static Cvdef
 get_cvdef(char *nam, char **args)
 {
-    Cvdef *p, *min, new;
-    int i, na = arrlen(args);
-
-    for (i = MAX_CVCACHE, p = cvdef_cache, min = NULL; *p && i--; p++)
-	if (*p && na == (*p)->ndefs && arrcmp(args, (*p)->defs)) {
-	    (*p)->lastt = time(0);
-
-	    return *p;
-	} else if (!min || !*p || (*p)->lastt < (*min)->lastt)
-	    min = p;
-    if (i > 0)
-	min = p;
+    Cvdef new, old;
+
+    if ((new = (Cvdef) defcache_get(&cvdef_cache, args)))
+	return new;
     if ((new = parse_cvdef(nam, args))) {
-	freecvdef(*min);
-	*min = new;
+	defcache_add(&cvdef_cache, new->defs, new);
+	while ((old = (Cvdef) defcache_trim(&cvdef_cache, cvdef_cache.max))) {
+	    cvdef_cache.evictions++;
+	    freecvdef(old);
+	}
     }
     return new;
 }
@@ -3355,6 +3531,22 @@ bin_compvalues(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 {
     int min, max, n;
 
+    if (!strcmp(args[0], "-c")) {
+	/* Cache control, allowed outside completion functions. */
+	Cvdef old;
+
+	if (args[1] && args[2]) {
+	    zwarnnam(nam, "too many arguments");
+	    return 1;
+	}
+	if (defcache_opt(nam, &cvdef_cache, args[1]))
+	    return 1;
+	while ((old = (Cvdef) defcache_trim(&cvdef_cache, cvdef_cache.max))) {
+	    cv_parsed = 0;
+	    freecvdef(old);
+	}
+	return 0;
+    }
     if (incompfunc != 1) {
 	zwarnnam(nam, "can only be called from completion function");
 	return 1;
@@ -4967,8 +5159,9 @@ static struct features module_features = {
 int
 setup_(UNUSED(Module m))
 {
-    memset(cadef_cache, 0, sizeof(cadef_cache));
-    memset(cvdef_cache, 0, sizeof(cvdef_cache));
+    memset(&cadef_cache, 0, sizeof(cadef_cache));
+    memset(&cvdef_cache, 0, sizeof(cvdef_cache));
+    cadef_cache.max = cvdef_cache.max = DEFCACHE_SIZE;
 
     memset(comptags, 0, sizeof(comptags));
 
@@ -5011,11 +5204,17 @@ int
 finish_(UNUSED(Module m))
 {
     int i;
-
-    for (i = 0; i < MAX_CACACHE; i++)
-	freecadef(cadef_cache[i]);
-    for (i = 0; i < MAX_CVCACHE; i++)
-	freecvdef(cvdef_cache[i]);
+    Cadef ad;
+    Cvdef vd;
+
+    while ((ad = (Cadef) defcache_trim(&cadef_cache, 0)))
+	freecadef(ad);
+    if (cadef_cache.htab)
+	zfree(cadef_cache.htab, cadef_cache.hsize * sizeof(Defent));
+    while ((vd = (Cvdef) defcache_trim(&cvdef_cache, 0)))
+	freecvdef(vd);
+    if (cvdef_cache.htab)
+	zfree(cvdef_cache.htab, cvdef_cache.hsize * sizeof(Defent));
 
     for (i = 0; i < MAX_TAGS; i++)
 	freectags(comptags[i]);
@@ -68,6 +68,14 @@ Keymap isearch_keymap;
  */
 #define GETZLETEXT(ent)	((ent)->zle_text ? (ent)->zle_text : (ent)->node.nam)
 
+/*
+ * Event numbers of the lines with zle_text set.  The history index
+ * only knows about the original text, so searches check these
+ * lines separately.
+ */
+static zlong *edited_hist;
+static int edited_histct, edited_histsz;
+
 /**/
 void
 remember_edits(void)
@@ -80,6 +88,14 @@ remember_edits(void)
 	if (!ent->zle_text || strcmp(line, ent->zle_text) != 0) {
 	    if (ent->zle_text)
 		free(ent->zle_text);
+	    else {
+		if (edited_histct == edited_histsz) {
+		    edited_histsz += 16;
+		    edited_hist = (zlong *)
+			zrealloc(edited_hist, edited_histsz * sizeof(zlong));
+		}
+		edited_hist[edited_histct++] = ent->histnum;
+	    }
 	    ent->zle_text = zlemetaline ? ztrdup(line) : line;
 	} else if (!zlemetaline)
 	    free(line);
@@ -98,12 +114,49 @@ forget_edits(void)
 	    he->zle_text = NULL;
 	}
     }
+    edited_histct = 0;
 }
 
 
 /*** Search utilities ***/
 
 
+/*
+ * Move from he to the next history entry in direction dir, skipping
+ * entries with flags in xflags, as movehistent() does; but if ncands
+ * is not negative, only stop at the entries in cands found from the
+ * history index, or which are being edited, since only those can
+ * match what we are looking for.
+ */
+
+static Histent
+movehistcand(Histent he, int dir, int xflags, zlong *cands, int ncands)
+{
+    zlong ev;
+
+    if (ncands < 0)
+	return movehistent(he, dir, xflags);
+    for (ev = he->histnum; ; ) {
+	zlong next = histidx_nextcand(cands, ncands, ev, dir);
+	int i;
+
+	for (i = 0; i < edited_histct; i++) {
+	    zlong ed = edited_hist[i];
+	    if ((dir > 0 ? ed > ev : ed < ev) &&
+		(next < 0 || (dir > 0 ? ed < next : ed > next)))
+		next = ed;
+	}
+	if (dir > 0 && curhist > ev && (next < 0 || curhist < next))
+	    next = curhist;
+	if (next < 0)
+	    return NULL;
+	ev = next;
+	if ((he = histidx_gethist(ev)) && !(he->node.flags & xflags))
+	    return he;
+    }
+}
+
+
 /*
  * Return zero if the ZLE string histp length histl and the ZLE string
  * inputp length inputl are the same.  Return -1 if inputp is a prefix
@@ -1175,6 +1228,11 @@ doisearch(char **args, int dir, int pattern)
      * Flag that the search was aborted.
      */
     int aborted = 0;
+    /*
+     * Candidate lines from the history index, if it can help.
+     */
+    zlong *cands = NULL;
+    int ncands = -1;
 
     if (!(he = quietgethist(hl)))
 	return 1;
@@ -1261,6 +1319,15 @@ doisearch(char **args, int dir, int pattern)
 		    statusline = ibuf;
 		}
 	    }
+	    if ((!pattern || patprog) && !nosearch &&
+		(zlereadflags & ZLRF_HISTORY)) {
+		char *str = sbuf + (sbuf[0] == '^');
+		if (cands)
+		    zfree(cands, ncands * sizeof(zlong));
+		cands = NULL;
+		ncands = pattern ? histidx_patlookup(str, &cands) :
+		    histidx_lookup(str, &cands);
+	    }
 	    /*
 	     * skip search if pattern compilation failed, or
 	     * if we back somewhere we already searched.
@@ -1391,7 +1458,8 @@ doisearch(char **args, int dir, int pattern)
 		 * the history to try again.
 		 */
 		if (!(zlereadflags & ZLRF_HISTORY)
-		 || !(he = movehistent(he, dir, hist_skip_flags))) {
+		 || !(he = movehistcand(he, dir, hist_skip_flags,
+					cands, ncands))) {
 		    if (sbptr == (int)isrch_spots[top_spot-1].len
 		     && (isrch_spots[top_spot-1].flags >> ISS_NOMATCH_SHIFT))
 			top_spot--;
@@ -1702,6 +1770,8 @@ doisearch(char **args, int dir, int pattern)
     zsfree(okeymap);
     if (matchlist)
 	freematchlist(matchlist);
+    if (cands)
+	zfree(cands, ncands * sizeof(zlong));
     isearch_active = 0;
     /*
      * Don't allow unused characters provided as a string to the
@@ -2005,8 +2075,9 @@ historybeginningsearchbackward(char **args)
 {
     Histent he;
     int cpos = zlecs;		/* save cursor position */
-    int n = zmult;
-    char *zt;
+    int n = zmult, ncands;
+    char *zt, sav;
+    zlong *cands = NULL;
 
     if (zmult < 0) {
 	int ret;
@@ -2018,9 +2089,12 @@ historybeginningsearchbackward(char **args)
     if (!(he = quietgethist(histline)))
 	return 1;
     metafy_line();
-    while ((he = movehistent(he, -1, hist_skip_flags))) {
+    sav = zlemetaline[zlemetacs];
+    zlemetaline[zlemetacs] = '\0';
+    ncands = histidx_lookup(zlemetaline, &cands);
+    zlemetaline[zlemetacs] = sav;
+    while ((he = movehistcand(he, -1, hist_skip_flags, cands, ncands))) {
 	int tst;
-	char sav;
 	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
 	    continue;
 	zt = GETZLETEXT(he);
@@ -2030,6 +2104,8 @@ historybeginningsearchbackward(char **args)
 	zlemetaline[zlemetacs] = sav;
 	if (tst < 0 && zlinecmp(zt, zlemetaline)) {
 	    if (--n <= 0) {
+		if (cands)
+		    zfree(cands, ncands * sizeof(zlong));
 		unmetafy_line();
 		zle_setline(he);
 		zlecs = cpos;
@@ -2038,6 +2114,8 @@ historybeginningsearchbackward(char **args)
 	    }
 	}
     }
+    if (cands)
+	zfree(cands, ncands * sizeof(zlong));
     unmetafy_line();
     return 1;
 }
@@ -2051,8 +2129,9 @@ historybeginningsearchforward(char **args)
 {
     Histent he;
     int cpos = zlecs;		/* save cursor position */
-    int n = zmult;
-    char *zt;
+    int n = zmult, ncands;
+    char *zt, sav;
+    zlong *cands = NULL;
 
     if (zmult < 0) {
 	int ret;
@@ -2064,8 +2143,11 @@ historybeginningsearchforward(char **args)
     if (!(he = quietgethist(histline)))
 	return 1;
     metafy_line();
-    while ((he = movehistent(he, 1, hist_skip_flags))) {
-	char sav;
+    sav = zlemetaline[zlemetacs];
+    zlemetaline[zlemetacs] = '\0';
+    ncands = histidx_lookup(zlemetaline, &cands);
+    zlemetaline[zlemetacs] = sav;
+    while ((he = movehistcand(he, 1, hist_skip_flags, cands, ncands))) {
 	int tst;
 	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
 	    continue;
@@ -2076,6 +2158,8 @@ historybeginningsearchforward(char **args)
 	zlemetaline[zlemetacs] = sav;
 	if (tst && zlinecmp(zt, zlemetaline)) {
 	    if (--n <= 0) {
+		if (cands)
+		    zfree(cands, ncands * sizeof(zlong));
 		unmetafy_line();
 		zle_setline(he);
 		zlecs = cpos;
@@ -2084,6 +2168,8 @@ historybeginningsearchforward(char **args)
 	    }
 	}
     }
+    if (cands)
+	zfree(cands, ncands * sizeof(zlong));
     unmetafy_line();
     return 1;
 }
@@ -91,6 +91,8 @@ static const struct gsu_integer numeric_gsu =
 { get_numeric, set_numeric, unset_numeric };
 static const struct gsu_integer pending_gsu =
 { get_pending, NULL, zleunsetfn };
+static const struct gsu_integer refresh_bytes_gsu =
+{ get_refresh_bytes, NULL, zleunsetfn };
 static const struct gsu_integer region_active_gsu =
 { get_region_active, set_region_active, zleunsetfn };
 static const struct gsu_integer undo_change_no_gsu =
@@ -170,6 +172,8 @@ static struct zleparam {
     { "SUFFIX_START", PM_INTEGER, GSU(suffixstart_gsu), NULL },
     { "SUFFIX_END", PM_INTEGER, GSU(suffixend_gsu), NULL },
     { "SUFFIX_ACTIVE", PM_INTEGER | PM_READONLY, GSU(suffixactive_gsu), NULL },
+    { "ZLE_REFRESH_BYTES", PM_INTEGER | PM_READONLY, GSU(refresh_bytes_gsu),
+	NULL },
     { "ZLE_STATE", PM_SCALAR | PM_READONLY, GSU(zle_state_gsu), NULL },
     { NULL, 0, NULL, NULL }
 };
@@ -503,6 +507,13 @@ get_pending(UNUSED(Param pm))
     return noquery(0);
 }
 
+/**/
+static zlong
+get_refresh_bytes(UNUSED(Param pm))
+{
+    return refresh_bytes;
+}
+
 /**/
 static zlong
 get_yankstart(UNUSED(Param pm))
@@ -27,8 +27,25 @@
  *
  */
 
+/* this is defined so we get the prototype for open_memstream */
+#define _GNU_SOURCE 1
+
 #include "zle.mdh"
 
+/*
+ * Number of bytes sent to the terminal by the last call to zrefresh(),
+ * for $ZLE_REFRESH_BYTES.  This is only known if the output can be
+ * collected in memory, see zrefresh().
+ */
+
+/**/
+zlong refresh_bytes;
+
+/* Begin and end synchronized update (DEC private mode 2026). */
+
+#define ZR_SYNC_BEGIN "\033[?2026h"
+#define ZR_SYNC_END   "\033[?2026l"
+
 #ifdef MULTIBYTE_SUPPORT
 /*
  * Handling for glyphs that contain more than one wide character,
@@ -998,6 +1015,12 @@ zrefresh(void)
 #ifdef MULTIBYTE_SUPPORT
     int width;			/* width of wide character		     */
 #endif
+#ifdef HAVE_OPEN_MEMSTREAM
+    static FILE *realshout;	/* terminal while output goes to memory	     */
+    FILE *mshout = NULL;	/* memory stream collecting the output	     */
+    char *mbuf = NULL;		/* its buffer...			     */
+    size_t mlen = 0, msync = 0;	/* ...its length and start of real output    */
+#endif
 
 
     /* If this is called from listmatches() (indirectly via trashzle()), and *
@@ -1007,6 +1030,29 @@ zrefresh(void)
     if (inlist)
 	return;
 
+#ifdef HAVE_OPEN_MEMSTREAM
+    /*
+     * Collect everything in memory and send it to the terminal with a
+     * single write at the end.  If ZLE_SYNCHRONIZED_OUTPUT is set the
+     * output is bracketed by the sequences telling the terminal not to
+     * display anything until the update is complete; that avoids
+     * flicker over slow connections or in terminal multiplexers.
+     * A nested call (e.g. from a signal handler) just adds to the
+     * same stream.
+     */
+    if (!realshout && shout && (mshout = open_memstream(&mbuf, &mlen))) {
+	char *sync = getsparam("ZLE_SYNCHRONIZED_OUTPUT");
+
+	fflush(shout);
+	realshout = shout;
+	shout = mshout;
+	if (sync && *sync && strcmp(sync, "0")) {
+	    fputs(ZR_SYNC_BEGIN, shout);
+	    msync = strlen(ZR_SYNC_BEGIN);
+	}
+    }
+#endif
+
     /*
      * zrefresh() is called from all over the place, so we can't
      * be sure if the line is metafied for completion or not.
@@ -1744,6 +1790,22 @@ individually */
     if (nlnct > vmaxln)
 	vmaxln = nlnct;
 singlelineout:
+#ifdef HAVE_OPEN_MEMSTREAM
+    if (mshout) {
+	/* See the comment on READ_MSTREAM in builtin.c for why there's
+	 * no fflush() here. */
+	if (msync && ftell(mshout) > (long)msync)
+	    fputs(ZR_SYNC_END, mshout);
+	shout = realshout;
+	realshout = NULL;
+	if (fclose(mshout) == 0 && mlen > msync) {
+	    fwrite(mbuf, mlen, 1, shout);
+	    refresh_bytes = mlen;
+	} else
+	    refresh_bytes = 0;
+	free(mbuf);
+    }
+#endif
     fflush(shout);		/* make sure everything is written out */
 
     if (tmpalloced)
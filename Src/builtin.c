@@ -1386,6 +1386,7 @@ bin_fc(char *nam, char **argv, Options ops, int func)
     char *s;
     struct asgment *asgf = NULL, *asgl = NULL;
     Patprog pprog = NULL;
+    char *patstr = NULL;
 
     /* fc is only permitted in interactive shells */
 #ifdef FACIST_INTERACTIVE
@@ -1444,6 +1445,7 @@ bin_fc(char *nam, char **argv, Options ops, int func)
     /* with the -m option, the first argument is taken *
      * as a pattern that history lines have to match   */
     if (*argv && OPT_ISSET(ops,'m')) {
+	patstr = dupstring(*argv);
 	tokenize(*argv);
 	if (!(pprog = patcompile(*argv++, 0, NULL))) {
 	    zwarnnam(nam, "invalid match pattern");
@@ -1561,7 +1563,7 @@ bin_fc(char *nam, char **argv, Options ops, int func)
     }
     if (OPT_ISSET(ops,'l')) {
 	/* list the required part of the history */
-	retval = fclist(stdout, ops, first, last, asgf, pprog, 0);
+	retval = fclist(stdout, ops, first, last, asgf, pprog, patstr, 0);
 	unqueue_signals();
     }
     else {
@@ -1593,7 +1595,7 @@ bin_fc(char *nam, char **argv, Options ops, int func)
 		}
 	    }
 	    ops->ind['n'] = 1;	/* No line numbers here. */
-	    if (!fclist(out, ops, first, last, asgf, pprog, 1)) {
+	    if (!fclist(out, ops, first, last, asgf, pprog, patstr, 1)) {
 		char *editor;
 
 		if (func == BIN_R)
@@ -1702,9 +1704,10 @@ fcsubs(char **sp, struct asgment *sub)
 /**/
 static int
 fclist(FILE *f, Options ops, zlong first, zlong last,
-       struct asgment *subs, Patprog pprog, int is_command)
+       struct asgment *subs, Patprog pprog, char *patstr, int is_command)
 {
-    int fclistdone = 0, xflags = 0;
+    int fclistdone = 0, xflags = 0, ncands = -1;
+    zlong *cands = NULL;
     zlong tmp;
     char *s, *tdfmt, *timebuf;
     Histent ent;
@@ -1762,8 +1765,15 @@ fclist(FILE *f, Options ops, zlong first, zlong last,
 	xflags |= HIST_READ;
     }
 
+    /* the history index can rule out most lines not matching patstr */
+    if (patstr)
+	ncands = histidx_patlookup(patstr, &cands);
+
     for (;;) {
-	if (ent->node.flags & xflags)
+	if ((ent->node.flags & xflags) ||
+	    (ncands >= 0 && ent->histnum != curhist &&
+	     histidx_nextcand(cands, ncands, ent->histnum - 1, 1) !=
+	     ent->histnum))
 	    s = NULL;
 	else
 	    s = dupstring(ent->node.nam);
@@ -1820,6 +1830,8 @@ fclist(FILE *f, Options ops, zlong first, zlong last,
     }
 
     /* final processing */
+    if (cands)
+	zfree(cands, ncands * sizeof(zlong));
     if (f != stdout)
 	fclose(f);
     if (!fclistdone) {
@@ -2163,6 +2175,7 @@ typeset_single(char *cname, char *pname, Param pm, UNUSED(int func),
 	    if (PM_TYPE(pm->node.flags) == PM_ARRAY) {
 		x = (*pm->gsu.a->getfn)(pm);
 		uniqarray(x);
+		arrvaluechanged(pm);
 		if (pm->node.flags & PM_SPECIAL) {
 		    if (zheapptr(x))
 			x = zarrdup(x);
@@ -2174,6 +2187,7 @@ typeset_single(char *cname, char *pname, Param pm, UNUSED(int func),
 			(Param) paramtab->getnode(paramtab, pm->ename))) {
 		x = (*apm->gsu.a->getfn)(apm);
 		uniqarray(x);
+		arrvaluechanged(apm);
 		if (x)
 		    arrfixenv(pm->node.nam, x);
 	    }
@@ -5725,6 +5739,28 @@ bin_eval(UNUSED(char *nam), char **argv, UNUSED(Options ops), UNUSED(int func))
 static char *zbuf;
 static int readfd;
 
+/*
+ * When read takes input from a regular file, it reads ahead in blocks
+ * rather than a byte at a time.  Before the builtin returns the file
+ * position is moved back to just after the last character used, so
+ * the effect is the same as if only those characters had been read,
+ * even for other processes sharing the file descriptor.  Pipes and
+ * terminals are still read a byte at a time, since input read from
+ * them can't be pushed back.
+ *
+ * Blocks start small, since lines are usually short and the excess
+ * is read again next time, and double in size as more input is needed.
+ */
+
+#define READBUF_MIN	128
+#define READBUF_MAX	8192
+
+static char readbuf[READBUF_MAX];
+static int readbufpos, readbuflen;
+
+/* Size of the next block to read, or zero if not reading ahead */
+static int readbufchunk;
+
 /* Read a character from readfd, or from the buffer zbuf.  Return EOF on end of
 file/buffer. */
 
@@ -5841,6 +5877,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	izle = 0;
     } else
 	readfd = izle = 0;
+    zreadbufinit(izle);
 
     if (OPT_ISSET(ops,'s') && SHTTY != -1) {
 	struct ttyinfo ti;
@@ -6288,6 +6325,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	    *pp++ = NULL;
 	    setaparam(reply, p);
 	}
+	zreadbufrestore();
 	if (resettty && SHTTY != -1)
 	    settyinfo(&saveti);
 	return c == EOF;
@@ -6417,6 +6455,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	    break;
     }
     *bptr = '\0';
+    zreadbufrestore();
     if (resettty && SHTTY != -1)
 	settyinfo(&saveti);
     /* final assignment of reply, etc. */
@@ -6478,9 +6517,23 @@ zread(int izle, int *readchar, long izle_timeout)
 	*readchar = -1;
 	return STOUC(cc);
     }
+    if (readbufpos < readbuflen)
+	return STOUC(readbuf[readbufpos++]);
     for (;;) {
-	/* read a character from readfd */
-	ret = read(readfd, &cc, 1);
+	if (readbufchunk) {
+	    /* read ahead from a regular file */
+	    ret = read(readfd, readbuf, readbufchunk);
+	    if (ret > 0) {
+		readbuflen = ret;
+		readbufpos = 1;
+		if (readbufchunk < READBUF_MAX)
+		    readbufchunk *= 2;
+		return STOUC(*readbuf);
+	    }
+	} else {
+	    /* read a character from readfd */
+	    ret = read(readfd, &cc, 1);
+	}
 	switch (ret) {
 	case 1:
 	    /* return the character read */
@@ -6510,6 +6563,32 @@ zread(int izle, int *readchar, long izle_timeout)
     }
 }
 
+/* Decide whether read can read ahead from readfd. */
+
+/**/
+static void
+zreadbufinit(int izle)
+{
+    struct stat st;
+
+    readbufpos = readbuflen = 0;
+    if (!izle && readfd >= 0 && !fstat(readfd, &st) && S_ISREG(st.st_mode))
+	readbufchunk = READBUF_MIN;
+    else
+	readbufchunk = 0;
+}
+
+/* Give back any input read ahead but not used. */
+
+/**/
+static void
+zreadbufrestore(void)
+{
+    if (readbufpos < readbuflen)
+	lseek(readfd, (off_t)(readbufpos - readbuflen), SEEK_CUR);
+    readbufpos = readbuflen = readbufchunk = 0;
+}
+
 /* holds arguments for testlex() */
 /**/
 char **testargs, **curtestarg;
@@ -40,37 +40,51 @@
 
 typedef struct gmatch *Gmatch;
 
-struct gmatch {
-    char *name;
-    /*
-     * Array of sort strings:  one for each GS_EXEC sort type in
-     * the glob qualifiers.
-     */
-    char **sortstrs;
+/*
+ * File attributes of a match.  These are only recorded if the
+ * matches are to be sorted by them.
+ */
+
+struct gmstat {
     off_t size ALIGN64;
     long atime;
     long mtime;
     long ctime;
     long links;
-    off_t _size ALIGN64;
-    long _atime;
-    long _mtime;
-    long _ctime;
-    long _links;
 #ifdef GET_ST_ATIME_NSEC
     long ansec;
-    long _ansec;
 #endif
 #ifdef GET_ST_MTIME_NSEC
     long mnsec;
-    long _mnsec;
 #endif
 #ifdef GET_ST_CTIME_NSEC
     long cnsec;
-    long _cnsec;
 #endif
 };
 
+struct gmatch {
+    char *name;
+    /*
+     * Collation key for name, if sorting by name other than
+     * numerically.
+     */
+    const char *namekey;
+    /*
+     * Array of sort strings:  one for each GS_EXEC sort type in
+     * the glob qualifiers.  Replaced by their collation keys
+     * unless sorting numerically.
+     */
+    char **sortstrs;
+    /*
+     * Attributes of the file and, for _st, of the file a symbolic
+     * link points to.  Each is only allocated if sorting by one of
+     * its attributes, so that matchbuf stays small when there are
+     * very many matches.
+     */
+    struct gmstat *st;
+    struct gmstat *_st;
+};
+
 #define GS_NAME   1
 #define GS_DEPTH  2
 #define GS_EXEC	  4
@@ -303,6 +317,31 @@ statfullpath(const char *s, struct stat *st, int l)
     return l ? lstat(buf, st) : stat(buf, st);
 }
 
+/* Record the attributes from buf for sorting a match by them. */
+
+/**/
+static struct gmstat *
+newgmstat(struct stat *buf)
+{
+    struct gmstat *st = (struct gmstat *)zhalloc(sizeof(struct gmstat));
+
+    st->size = buf->st_size;
+    st->atime = buf->st_atime;
+    st->mtime = buf->st_mtime;
+    st->ctime = buf->st_ctime;
+    st->links = buf->st_nlink;
+#ifdef GET_ST_ATIME_NSEC
+    st->ansec = GET_ST_ATIME_NSEC(*buf);
+#endif
+#ifdef GET_ST_MTIME_NSEC
+    st->mnsec = GET_ST_MTIME_NSEC(*buf);
+#endif
+#ifdef GET_ST_CTIME_NSEC
+    st->cnsec = GET_ST_CTIME_NSEC(*buf);
+#endif
+    return st;
+}
+
 /* This may be set by qualifier functions to an array of strings to insert
  * into the list instead of the original string. */
 
@@ -412,51 +451,262 @@ insert(char *s, int checked)
 	    statted |= 2;
 	}
 	matchptr->name = news;
-	if (statted & 1) {
-	    matchptr->size = buf.st_size;
-	    matchptr->atime = buf.st_atime;
-	    matchptr->mtime = buf.st_mtime;
-	    matchptr->ctime = buf.st_ctime;
-	    matchptr->links = buf.st_nlink;
-#ifdef GET_ST_ATIME_NSEC
-	    matchptr->ansec = GET_ST_ATIME_NSEC(buf);
-#endif
+	if (gf_sorts & GS_NORMAL)
+	    matchptr->st = newgmstat(&buf);
+	if (gf_sorts & GS_LINKED)
+	    matchptr->_st = newgmstat(&buf2);
+	matchptr++;
+
+	if (++matchct == matchsz) {
+	    matchbuf = (Gmatch)zrealloc((char *)matchbuf,
+					sizeof(struct gmatch) * (matchsz *= 2));
+
+	    matchptr = matchbuf + matchct;
+	}
+	if (!inserts)
+	    break;
+    }
+    unqueue_signals();
+    return;
+}
+
+/*
+ * Cache of directory listings for scanner(), used if GLOBCACHESIZE is
+ * positive.  A listing is looked up by the device and inode of the
+ * directory, and only used while the directory's modification and
+ * change times are what they were when it was read.  Directories
+ * modified in the same second as they are read aren't cached, since
+ * a further change within that second couldn't be detected.
+ */
+
+typedef struct globdir *Globdir;
+
+struct globdir {
+    struct hashnode node;	/* name is made from dev and ino */
+    Globdir prev, next;		/* list in order of most recent use */
+    dev_t dev;
+    ino_t ino;
+    time_t mtime, ctime;
 #ifdef GET_ST_MTIME_NSEC
-	    matchptr->mnsec = GET_ST_MTIME_NSEC(buf);
+    long mnsec;
 #endif
 #ifdef GET_ST_CTIME_NSEC
-	    matchptr->cnsec = GET_ST_CTIME_NSEC(buf);
+    long cnsec;
 #endif
+    int len;			/* length of names */
+    char *names;		/* metafied names, each followed by a null */
+};
+
+/* Maximum number of directories whose listings are cached */
+
+/**/
+zlong globcachesize;
+
+/* Number of listings found in the cache, and number read instead */
+
+/**/
+zlong globcachehits, globcachemisses;
+
+static HashTable globdirtab;
+static Globdir globdirmru, globdirlru;
+
+/* State of scanner() reading a directory, or its cached listing */
+
+struct globreaddir {
+    DIR *dir;			/* directory being read, NULL if cached */
+    char *next, *end;		/* rest of the cached listing */
+    char *key;			/* key if the listing is to be cached */
+    struct stat st;		/* the directory, if key is set */
+    char *buf;			/* names read so far, if key is set */
+    int len, size;
+    int done;			/* set when the whole directory was read */
+};
+
+/**/
+static void
+freeglobdirnode(HashNode hn)
+{
+    Globdir gd = (Globdir) hn;
+
+    zsfree(gd->node.nam);
+    if (gd->names)
+	zfree(gd->names, gd->len);
+    zfree(gd, sizeof(struct globdir));
+}
+
+static void
+unlinkglobdir(Globdir gd)
+{
+    if (gd->prev)
+	gd->prev->next = gd->next;
+    else
+	globdirmru = gd->next;
+    if (gd->next)
+	gd->next->prev = gd->prev;
+    else
+	globdirlru = gd->prev;
+}
+
+/**/
+static void
+removeglobdir(char *key)
+{
+    HashNode hn = globdirtab->removenode(globdirtab, key);
+
+    if (hn) {
+	unlinkglobdir((Globdir) hn);
+	globdirtab->freenode(hn);
+    }
+}
+
+/* Drop least recently used listings until there are no more than *
+ * GLOBCACHESIZE.                                                  */
+
+/**/
+void
+trimglobcache(void)
+{
+    while (globdirlru && globdirtab->ct > globcachesize)
+	removeglobdir(globdirlru->node.nam);
+}
+
+/* Number of directories in the cache */
+
+/**/
+int
+globcachecount(void)
+{
+    return globdirtab ? globdirtab->ct : 0;
+}
+
+/* Open the directory fn for scanner(), or find its cached listing. *
+ * Returns zero if the directory can't be read.                      */
+
+static int
+globopendir(struct globreaddir *gr, char *fn)
+{
+    memset(gr, 0, sizeof(*gr));
+    if (globcachesize > 0 && !stat(fn, &gr->st) && S_ISDIR(gr->st.st_mode)) {
+	char key[2 * DIGBUFSIZE];
+	Globdir gd;
+
+	if (!globdirtab) {
+	    globdirtab = newhashtable(127, "globdirtab", NULL);
+
+	    globdirtab->hash        = hasher;
+	    globdirtab->emptytable  = NULL;
+	    globdirtab->filltable   = NULL;
+	    globdirtab->cmpnodes    = strcmp;
+	    globdirtab->addnode     = addhashnode;
+	    globdirtab->getnode     = gethashnode2;
+	    globdirtab->getnode2    = gethashnode2;
+	    globdirtab->removenode  = removehashnode;
+	    globdirtab->disablenode = NULL;
+	    globdirtab->enablenode  = NULL;
+	    globdirtab->freenode    = freeglobdirnode;
+	    globdirtab->printnode   = NULL;
 	}
-	if (statted & 2) {
-	    matchptr->_size = buf2.st_size;
-	    matchptr->_atime = buf2.st_atime;
-	    matchptr->_mtime = buf2.st_mtime;
-	    matchptr->_ctime = buf2.st_ctime;
-	    matchptr->_links = buf2.st_nlink;
-#ifdef GET_ST_ATIME_NSEC
-	    matchptr->_ansec = GET_ST_ATIME_NSEC(buf2);
-#endif
+	sprintf(key, "%lx:%lx", (unsigned long)gr->st.st_dev,
+		(unsigned long)gr->st.st_ino);
+	if ((gd = (Globdir) globdirtab->getnode(globdirtab, key))) {
+	    if (gd->dev == gr->st.st_dev && gd->ino == gr->st.st_ino &&
+		gd->mtime == gr->st.st_mtime && gd->ctime == gr->st.st_ctime
 #ifdef GET_ST_MTIME_NSEC
-	    matchptr->_mnsec = GET_ST_MTIME_NSEC(buf2);
+		&& gd->mnsec == GET_ST_MTIME_NSEC(gr->st)
 #endif
 #ifdef GET_ST_CTIME_NSEC
-	    matchptr->_cnsec = GET_ST_CTIME_NSEC(buf2);
+		&& gd->cnsec == GET_ST_CTIME_NSEC(gr->st)
 #endif
+		) {
+		globcachehits++;
+		unlinkglobdir(gd);
+		gd->prev = NULL;
+		if ((gd->next = globdirmru))
+		    globdirmru->prev = gd;
+		else
+		    globdirlru = gd;
+		globdirmru = gd;
+		/* A copy, since globbing in qualifiers may change the cache */
+		gr->next = (char *) zhalloc(gd->len + 1);
+		memcpy(gr->next, gd->names, gd->len);
+		gr->end = gr->next + gd->len;
+		return 1;
+	    }
+	    removeglobdir(key);
 	}
-	matchptr++;
+	globcachemisses++;
+	if (gr->st.st_mtime < time(NULL))
+	    gr->key = dupstring(key);
+    }
+    return !!(gr->dir = opendir(fn));
+}
 
-	if (++matchct == matchsz) {
-	    matchbuf = (Gmatch)zrealloc((char *)matchbuf,
-					sizeof(struct gmatch) * (matchsz *= 2));
+/* Get the next name for scanner(), metafied, or NULL at the end. */
 
-	    matchptr = matchbuf + matchct;
+static char *
+globreaddir(struct globreaddir *gr)
+{
+    char *fn;
+
+    if (!gr->dir) {
+	if (gr->next >= gr->end)
+	    return NULL;
+	fn = gr->next;
+	gr->next += strlen(fn) + 1;
+	return fn;
+    }
+    if (!(fn = zreaddir(gr->dir, 1)))
+	gr->done = 1;
+    else if (gr->key) {
+	int l = strlen(fn) + 1;
+
+	if (gr->len + l > gr->size) {
+	    int nsize = gr->size ? 2 * gr->size : 256;
+
+	    while (gr->len + l > nsize)
+		nsize *= 2;
+	    gr->buf = (char *) zrealloc(gr->buf, nsize);
+	    gr->size = nsize;
 	}
-	if (!inserts)
-	    break;
+	memcpy(gr->buf + gr->len, fn, l);
+	gr->len += l;
     }
-    unqueue_signals();
-    return;
+    return fn;
+}
+
+/* Finish reading a directory, caching it if it was read completely. */
+
+static void
+globclosedir(struct globreaddir *gr)
+{
+    if (!gr->dir)
+	return;
+    closedir(gr->dir);
+    if (gr->key && gr->done && globcachesize > 0) {
+	Globdir gd = (Globdir) zshcalloc(sizeof(struct globdir));
+
+	gd->dev = gr->st.st_dev;
+	gd->ino = gr->st.st_ino;
+	gd->mtime = gr->st.st_mtime;
+	gd->ctime = gr->st.st_ctime;
+#ifdef GET_ST_MTIME_NSEC
+	gd->mnsec = GET_ST_MTIME_NSEC(gr->st);
+#endif
+#ifdef GET_ST_CTIME_NSEC
+	gd->cnsec = GET_ST_CTIME_NSEC(gr->st);
+#endif
+	if ((gd->len = gr->len))
+	    gd->names = (char *) zrealloc(gr->buf, gr->len);
+	removeglobdir(gr->key);
+	globdirtab->addnode(globdirtab, ztrdup(gr->key), gd);
+	if ((gd->next = globdirmru))
+	    globdirmru->prev = gd;
+	else
+	    globdirlru = gd;
+	globdirmru = gd;
+	trimglobcache();
+    } else if (gr->buf)
+	zfree(gr->buf, gr->size);
 }
 
 /* Do the globbing:  scanner is called recursively *
@@ -549,13 +799,13 @@ scanner(Complist q, int shortcircuit)
 	/* Do pattern matching on current path section. */
 	char *fn = pathbuf[pathbufcwd] ? unmeta(pathbuf + pathbufcwd) : ".";
 	int dirs = !!q->next;
-	DIR *lock = opendir(fn);
+	struct globreaddir gr;
 	char *subdirs = NULL;
 	int subdirlen = 0;
 
-	if (lock == NULL)
+	if (!globopendir(&gr, fn))
 	    return;
-	while ((fn = zreaddir(lock, 1)) && !errflag) {
+	while ((fn = globreaddir(&gr)) && !errflag) {
 	    /* prefix and suffix are zle trickery */
 	    if (!dirs && !colonmod &&
 		((glob_pre && !strpfx(glob_pre, fn))
@@ -635,13 +885,13 @@ scanner(Complist q, int shortcircuit)
 		    /* if the last filename component, just add it */
 		    insert(fn, 1);
 		    if (shortcircuit && shortcircuit == matchct) {
-			closedir(lock);
+			globclosedir(&gr);
 			return;
 		    }
 		}
 	    }
 	}
-	closedir(lock);
+	globclosedir(&gr);
 	if (subdirs) {
 	    int oppos = pathpos;
 
@@ -911,7 +1161,10 @@ gmatchcmp(Gmatch a, Gmatch b)
     for (i = gf_nsorts, s = gf_sortlist; i; i--, s++) {
 	switch (s->tp & ~GS_DESC) {
 	case GS_NAME:
-	    r = zstrcmp(b->name, a->name, gf_numsort ? SORTIT_NUMERICALLY : 0);
+	    if (gf_numsort)
+		r = zstrcmp(b->name, a->name, SORTIT_NUMERICALLY);
+	    else
+		r = strcmp(b->namekey, a->namekey);
 	    break;
 	case GS_DEPTH:
 	    {
@@ -946,62 +1199,64 @@ gmatchcmp(Gmatch a, Gmatch b)
 		asortstrp++;
 		bsortstrp++;
 	    }
-	    r = zstrcmp(*bsortstrp, *asortstrp,
-			gf_numsort ? SORTIT_NUMERICALLY : 0);
+	    if (gf_numsort)
+		r = zstrcmp(*bsortstrp, *asortstrp, SORTIT_NUMERICALLY);
+	    else
+		r = strcmp(*bsortstrp, *asortstrp);
 	    break;
 	case GS_SIZE:
-	    r = b->size - a->size;
+	    r = b->st->size - a->st->size;
 	    break;
 	case GS_ATIME:
-	    r = a->atime - b->atime;
+	    r = a->st->atime - b->st->atime;
 #ifdef GET_ST_ATIME_NSEC
             if (!r)
-              r = a->ansec - b->ansec;
+              r = a->st->ansec - b->st->ansec;
 #endif
 	    break;
 	case GS_MTIME:
-	    r = a->mtime - b->mtime;
+	    r = a->st->mtime - b->st->mtime;
 #ifdef GET_ST_MTIME_NSEC
             if (!r)
-              r = a->mnsec - b->mnsec;
+              r = a->st->mnsec - b->st->mnsec;
 #endif
 	    break;
 	case GS_CTIME:
-	    r = a->ctime - b->ctime;
+	    r = a->st->ctime - b->st->ctime;
 #ifdef GET_ST_CTIME_NSEC
             if (!r)
-              r = a->cnsec - b->cnsec;
+              r = a->st->cnsec - b->st->cnsec;
 #endif
 	    break;
 	case GS_LINKS:
-	    r = b->links - a->links;
+	    r = b->st->links - a->st->links;
 	    break;
 	case GS__SIZE:
-	    r = b->_size - a->_size;
+	    r = b->_st->size - a->_st->size;
 	    break;
 	case GS__ATIME:
-	    r = a->_atime - b->_atime;
+	    r = a->_st->atime - b->_st->atime;
 #ifdef GET_ST_ATIME_NSEC
             if (!r)
-              r = a->_ansec - b->_ansec;
+              r = a->_st->ansec - b->_st->ansec;
 #endif
 	    break;
 	case GS__MTIME:
-	    r = a->_mtime - b->_mtime;
+	    r = a->_st->mtime - b->_st->mtime;
 #ifdef GET_ST_MTIME_NSEC
             if (!r)
-              r = a->_mnsec - b->_mnsec;
+              r = a->_st->mnsec - b->_st->mnsec;
 #endif
 	    break;
 	case GS__CTIME:
-	    r = a->_ctime - b->_ctime;
+	    r = a->_st->ctime - b->_st->ctime;
 #ifdef GET_ST_CTIME_NSEC
             if (!r)
-              r = a->_cnsec - b->_cnsec;
+              r = a->_st->cnsec - b->_st->cnsec;
 #endif
 	    break;
 	case GS__LINKS:
-	    r = b->_links - a->_links;
+	    r = b->_st->links - a->_st->links;
 	    break;
 	}
 	if (r)
@@ -1856,7 +2111,7 @@ zglob(LinkList list, LinkNode np, int nountok)
 	 * Get the strings to use for sorting by executing
 	 * the code chunk.  We allow more than one of these.
 	 */
-	int nexecs = 0;
+	int nexecs = 0, byname = 0;
 	struct globsort *sortp;
 	struct globsort *lastsortp = gf_sortlist + gf_nsorts;
 
@@ -1865,6 +2120,8 @@ zglob(LinkList list, LinkNode np, int nountok)
 	{
 	    if (sortp->tp & GS_EXEC)
 		nexecs++;
+	    else if ((sortp->tp & ~GS_DESC) == GS_NAME)
+		byname = 1;
 	}
 
 	if (nexecs) {
@@ -1910,6 +2167,23 @@ zglob(LinkList list, LinkNode np, int nountok)
 	    }
 	}
 
+	/*
+	 * Unless sorting numerically, work out the collation keys
+	 * once here, not in every comparison made by the sort.
+	 */
+	if (!gf_numsort && (byname || nexecs)) {
+	    Gmatch tmpptr;
+	    int xfrm = sortkeyxfrm(), iexec;
+
+	    for (tmpptr = matchbuf; tmpptr < matchptr; tmpptr++) {
+		if (byname)
+		    tmpptr->namekey = sortkey(tmpptr->name, xfrm);
+		for (iexec = 0; iexec < nexecs; iexec++)
+		    tmpptr->sortstrs[iexec] =
+			(char *)sortkey(tmpptr->sortstrs[iexec], xfrm);
+	    }
+	}
+
 	/* Sort arguments in to lexical (and possibly numeric) order. *
 	 * This is reversed to facilitate insertion into the list.    */
 	qsort((void *) & matchbuf[0], matchct, sizeof(struct gmatch),
@@ -2203,6 +2477,177 @@ bracechardots(char *str, convchar_t *c1p, convchar_t *c2p)
     return 1;
 }
 
+/*
+ * Parse a numeric brace range.  str points to the opening brace and
+ * str2 to the matching closing brace, and dotdot is the number of
+ * ".."s between them.  If the range is valid, set up br to produce
+ * its values in the order they are expanded and return 1.
+ */
+
+/**/
+mod_export int
+getbracerange(char *str, char *str2, int dotdot, Bracerange br)
+{
+    char *dots, *p, *dots2 = NULL;
+    zlong rstart, rend, rincr = 1;
+    int err = 0, rev = 0, wid1, wid2, wid3, minw;
+
+    /* Get the first number of the range */
+    rstart = zstrtol(str+1,&dots,10);
+    rend = 0;
+    wid1 = (dots - str) - 1;
+    wid2 = (str2 - dots) - 2;
+    wid3 = 0;
+
+    if (dots == str + 1 || *dots != '.' || dots[1] != '.')
+	err++;
+    else {
+	/* Get the last number of the range */
+	rend = zstrtol(dots+2,&p,10);
+	if (p == dots+2)
+	    err++;
+	/* check for {num1..num2..incr} */
+	if (p != str2) {
+	    wid2 = (p - dots) - 2;
+	    dots2 = p;
+	    if (dotdot == 2 && *p == '.' && p[1] == '.') {
+		rincr = zstrtol(p+2, &p, 10);
+		wid3 = p - dots2 - 2;
+		if (p != str2 || !rincr)
+		    err++;
+	    } else
+		err++;
+	}
+    }
+    if (err)
+	return 0;
+    /* If either no. begins with a zero, pad the output with   *
+     * zeroes. Otherwise, set min width to 0 to suppress them.
+     * str+1 is the first number in the range, dots+2 the last,
+     * and dots2+2 is the increment if that's given. */
+    /* TODO: sorry about this */
+    minw = (str[1] == '0' || (str[1] == '-' && str[2] == '0'))
+	   ? wid1
+	   : (dots[2] == '0' || (dots[2] == '-' && dots[3] == '0'))
+	   ? wid2
+	   : (dots2 && (dots2[2] == '0' ||
+			(dots2[2] == '-' && dots2[3] == '0')))
+	   ? wid3
+	   : 0;
+    if (rincr < 0) {
+	/* Handle negative increment */
+	rincr = -rincr;
+	rev = !rev;
+    }
+    if (rstart > rend) {
+	/* Handle decreasing ranges correctly. */
+	zlong rt = rend;
+	rend = rstart;
+	rstart = rt;
+	rev = !rev;
+    } else if (rincr > 1) {
+	/* when incr > 1, range is aligned to the highest number of str1,
+	 * compensate for this so that it is aligned to the first number */
+	rend -= (rend - rstart) % rincr;
+    }
+    /* The values are rend, rend - rincr, ... down to rstart. */
+    br->count = (rend - rstart) / rincr + 1;
+    if (rev) {
+	br->val = rend;
+	br->incr = -rincr;
+    } else {
+	br->val = rend - (br->count - 1) * rincr;
+	br->incr = rincr;
+    }
+    br->minw = minw;
+    return 1;
+}
+
+/*
+ * Write the next value of a brace range into buf, which must have
+ * room for DIGBUFSIZE or br->minw characters, whichever is more.
+ * Returns the length, without a terminating null.
+ */
+
+/**/
+static int
+formatbracerange(Bracerange br, char *buf)
+{
+    char digits[DIGBUFSIZE], *p = digits + DIGBUFSIZE;
+    zlong v = br->val;
+    zulong u = (v < 0) ? -(zulong)v : (zulong)v;
+    int n, len = 0;
+
+    do {
+	*--p = '0' + (int)(u % 10);
+	u /= 10;
+    } while (u);
+    n = digits + DIGBUFSIZE - p;
+    if (v < 0)
+	buf[len++] = '-';
+    while (len + n < br->minw)
+	buf[len++] = '0';
+    memcpy(buf + len, p, n);
+    if (--br->count)
+	br->val += br->incr;
+    return len + n;
+}
+
+/*
+ * Return the next value of a brace range on the heap, or NULL if
+ * there are no more.
+ */
+
+/**/
+mod_export char *
+nextbracerange(Bracerange br)
+{
+    char *buf;
+    int l;
+
+    if (!br->count)
+	return NULL;
+    buf = (char *) zhalloc((br->minw > DIGBUFSIZE ? br->minw : DIGBUFSIZE)
+			   + 1);
+    l = formatbracerange(br, buf);
+    buf[l] = '\0';
+    return buf;
+}
+
+/*
+ * Check if list consists of a single word that is nothing but a
+ * numeric brace range, like the {1..1000000} in a for loop, and if
+ * so set up br to produce the words it expands to.  Nothing else in
+ * prefork() or globbing can change those, so the caller can take
+ * them one at a time instead of expanding the list.
+ */
+
+/**/
+mod_export int
+isbracerange(LinkList list, Bracerange br)
+{
+    char *str, *str2;
+    int dotdot = 0;
+
+    if (isset(IGNOREBRACES) || !firstnode(list) ||
+	nextnode(firstnode(list)))
+	return 0;
+    str = (char *) getdata(firstnode(list));
+    if (*str != Inbrace)
+	return 0;
+    for (str2 = str + 1; *str2 != Outbrace; str2++) {
+	if (*str2 == '.' && str2[1] == '.') {
+	    dotdot++;
+	    str2++;
+	} else if (*str2 != '-' && !idigit(*str2))
+	    return 0;
+    }
+    if (str2[1] || !dotdot || bracechardots(str, NULL, NULL) ||
+	!hasbraces(str))
+	return 0;
+    return getbracerange(str, str2, dotdot, br);
+}
+
 /* brace expansion */
 
 /**/
@@ -2233,12 +2678,10 @@ xpandbraces(LinkList list, LinkNode *np)
     if (!comma && dotdot) {
 	/* Expand range like 0..10 numerically: comma or recursive
 	   brace expansion take precedence. */
-	char *dots, *p, *dots2 = NULL;
+	char *p;
 	LinkNode olast = last;
-	/* Get the first number of the range */
-	zlong rstart, rend;
-	int err = 0, rev = 0, rincr = 1;
-	int wid1, wid2, wid3, strp;
+	struct bracerange br;
+	int rev = 0, strp;
 	convchar_t cstart, cend;
 
 	if (bracechardots(str, &cstart, &cend)) {
@@ -2280,77 +2723,21 @@ xpandbraces(LinkList list, LinkNode *np)
 	    return;
 	}
 
-	/* Get the first number of the range */
-	rstart = zstrtol(str+1,&dots,10);
-	rend = 0;
-	wid1 = (dots - str) - 1;
-	wid2 = (str2 - dots) - 2;
-	wid3 = 0;
-	strp = str - str3;
+	if (getbracerange(str, str2, dotdot, &br)) {
+	    /* Build each word directly; the number goes in buf first. */
+	    int buflen = (br.minw > DIGBUFSIZE ? br.minw : DIGBUFSIZE) + 1;
+	    int l, sufl = strlen(str2 + 1);
+	    char *buf = (char *) zhalloc(buflen);
 
-	if (dots == str + 1 || *dots != '.' || dots[1] != '.')
-	    err++;
-	else {
-	    /* Get the last number of the range */
-	    rend = zstrtol(dots+2,&p,10);
-	    if (p == dots+2)
-		err++;
-	    /* check for {num1..num2..incr} */
-	    if (p != str2) {
-		wid2 = (p - dots) - 2;
-		dots2 = p;
-		if (dotdot == 2 && *p == '.' && p[1] == '.') {
-		    rincr = zstrtol(p+2, &p, 10);
-		    wid3 = p - dots2 - 2;
-		    if (p != str2 || !rincr)
-			err++;
-		} else
-		    err++;
-	    }
-	}
-	if (!err) {
-	    /* If either no. begins with a zero, pad the output with   *
-	     * zeroes. Otherwise, set min width to 0 to suppress them.
-	     * str+1 is the first number in the range, dots+2 the last,
-	     * and dots2+2 is the increment if that's given. */
-	    /* TODO: sorry about this */
-	    int minw = (str[1] == '0' || (str[1] == '-' && str[2] == '0'))
-		       ? wid1
-		       : (dots[2] == '0' || (dots[2] == '-' && dots[3] == '0'))
-		       ? wid2
-		       : (dots2 && (dots2[2] == '0' ||
-				    (dots2[2] == '-' && dots2[3] == '0')))
-		       ? wid3
-		       : 0;
-	    if (rincr < 0) {
-		/* Handle negative increment */
-		rincr = -rincr;
-		rev = !rev;
-	    }
-	    if (rstart > rend) {
-		/* Handle decreasing ranges correctly. */
-		zlong rt = rend;
-		rend = rstart;
-		rstart = rt;
-		rev = !rev;
-	    } else if (rincr > 1) {
-		/* when incr > 1, range is aligned to the highest number of str1,
-		 * compensate for this so that it is aligned to the first number */
-		rend -= (rend - rstart) % rincr;
-	    }
+	    strp = str - str3;
 	    uremnode(list, node);
-	    for (; rend >= rstart; rend -= rincr) {
-		/* Node added in at end, so do highest first */
-		p = dupstring(str3);
-#if defined(ZLONG_IS_LONG_LONG) && defined(PRINTF_HAS_LLD)
-		sprintf(p + strp, "%0*lld", minw, rend);
-#else
-		sprintf(p + strp, "%0*ld", minw, (long)rend);
-#endif
-		strcat(p + strp, str2 + 1);
-		insertlinknode(list, last, p);
-		if (rev)	/* decreasing:  add in reverse order. */
-		    last = nextnode(last);
+	    while (br.count) {
+		l = formatbracerange(&br, buf);
+		p = (char *) zhalloc(strp + l + sufl + 1);
+		memcpy(p, str3, strp);
+		memcpy(p + strp, buf, l);
+		memcpy(p + strp + l, str2 + 1, sufl + 1);
+		last = insertlinknode(list, last, p);
 	    }
 	    *np = nextnode(olast);
 	    return;
@@ -2480,9 +2867,16 @@ get_match_ret(Imatchdata imd, int b, int e)
     int ll = 0, bl = 0, t = 0, add = 0, fl = imd->flags, i;
 
     /* Account for b and e referring to unmetafied string */
-    for (p = imd->ustr; p < imd->ustr + b; p++)
+    if (b >= imd->uoff) {
+	p = imd->ustr + imd->uoff;
+	add = imd->madd;
+    } else
+	p = imd->ustr;
+    for (; p < imd->ustr + b; p++)
 	if (imeta(*p))
 	    add++;
+    imd->uoff = b;
+    imd->madd = add;
     b += add;
     for (; p < imd->ustr + e; p++)
 	if (imeta(*p))
@@ -2731,6 +3125,27 @@ set_pat_end(Patprog p, char null_me)
 	p->flags &= ~PAT_NOTEND;
 }
 
+/*
+ * If the pattern is a plain string pstr of length plen, find where
+ * it next occurs in the unmetafied test string from t to send, so we
+ * don't need to try the pattern at each position along the way.
+ * Returns NULL if it doesn't occur.
+ */
+
+/**/
+static char *
+purestrnext(char *t, char *send, char *pstr, int plen)
+{
+    while (send - t >= plen) {
+	if (!(t = memchr(t, *pstr, (send - t) - plen + 1)))
+	    break;
+	if (!memcmp(t, pstr, plen))
+	    return t;
+	t++;
+    }
+    return NULL;
+}
+
 /**/
 #ifdef MULTIBYTE_SUPPORT
 
@@ -2769,9 +3184,11 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
      * the string (typically t).
      */
     int ioff, l = strlen(*sp), matched = 1, umltot = ztrlen(*sp);
-    int umlen, nmatches;
+    int umlen, nmatches, plen = 0;
     struct patstralloc patstralloc;
     struct imatchdata imd;
+    /* Unmetafied pattern if it's a plain string, see purestrnext() */
+    char *pstr = NULL;
 
     (void)patallocstr(p, s, l, umltot, 1, &patstralloc);
     s = patstralloc.alloced;
@@ -2785,6 +3202,12 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
     imd.flags = fl;
     imd.replstr = replstr;
     imd.repllist = NULL;
+    imd.uoff = imd.madd = 0;
+
+    if ((p->flags & PAT_PURES) && p->patmlen) {
+	pstr = dupstrpfx((char *)p + p->startoff, p->patmlen);
+	unmetafy(pstr, &plen);
+    }
 
     /* perform must-match test for complex closures */
     if (p->mustoff)
@@ -2944,6 +3367,15 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
 		/* loop over all matches for global substitution */
 		matched = 0;
 		for (; t < send; ioff++) {
+		    if (pstr) {
+			char *next = purestrnext(t, send, pstr, plen);
+			if (!next)
+			    break;
+			while (t < next) {
+			    ioff++;
+			    umlen -= iincchar(&t, send - t);
+			}
+		    }
 		    /* Find the longest match from this position. */
 		    set_pat_start(p, t-s);
 		    if (pattrylen(p, t, umlen, 0, &patstralloc, ioff)) {
@@ -3039,6 +3471,15 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
 	    tmatch = NULL;
 	    mb_charinit();
 	    for (ioff = 0, t = s, umlen = umltot; t < send; ioff++) {
+		if (pstr) {
+		    char *next = purestrnext(t, send, pstr, plen);
+		    if (!next)
+			break;
+		    while (t < next) {
+			ioff++;
+			umlen -= iincchar(&t, send - t);
+		    }
+		}
 		set_pat_start(p, t-s);
 		if (pattrylen(p, t, umlen, 0, &patstralloc, ioff)) {
 		    nmatches++;
@@ -3164,8 +3605,11 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
      * lengths.
      */
     int ioff, l = strlen(*sp), uml = ztrlen(*sp), matched = 1, umlen;
+    int plen = 0;
     struct patstralloc patstralloc;
     struct imatchdata imd;
+    /* Unmetafied pattern if it's a plain string, see purestrnext() */
+    char *pstr = NULL;
 
     (void)patallocstr(p, s, l, uml, 1, &patstralloc);
     s = patstralloc.alloced;
@@ -3179,6 +3623,12 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
     imd.flags = fl;
     imd.replstr = replstr;
     imd.repllist = NULL;
+    imd.uoff = imd.madd = 0;
+
+    if ((p->flags & PAT_PURES) && p->patmlen) {
+	pstr = dupstrpfx((char *)p + p->startoff, p->patmlen);
+	unmetafy(pstr, &plen);
+    }
 
     /* perform must-match test for complex closures */
     if (p->mustoff)
@@ -3290,6 +3740,14 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
 		/* loop over all matches for global substitution */
 		matched = 0;
 		for (; t < send; t++, ioff++, umlen--) {
+		    if (pstr) {
+			char *next = purestrnext(t, send, pstr, plen);
+			if (!next)
+			    break;
+			ioff += next - t;
+			umlen -= next - t;
+			t = next;
+		    }
 		    /* Find the longest match from this position. */
 		    set_pat_start(p, t-s);
 		    if (pattrylen(p, t, send - t, umlen, &patstralloc, ioff)) {
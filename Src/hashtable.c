@@ -1403,6 +1403,7 @@ addhistnode(HashTable ht, char *nam, void *nodeptr)
     }
     else
 	he->node.flags &= ~HIST_MAKEUNIQUE;
+    histidx_add(he);
 }
 
 /**/
@@ -1420,6 +1421,7 @@ freehistdata(Histent he, int unlink)
     if (!he)
 	return;
 
+    histidx_remove(he);
     if (!(he->node.flags & (HIST_DUP | HIST_TMPSTORE)))
 	removehashnode(histtab, he->node.nam);
 
@@ -218,6 +218,7 @@ static struct histsave {
     zlong histlinect;
     zlong histsiz;
     zlong savehistsiz;
+    struct histidx *histindex;
     int locallevel;
 } *histsave_stack;
 static int histsave_stack_size = 0;
@@ -1253,6 +1254,458 @@ gethistent(zlong ev, int nearmatch)
     return he;
 }
 
+/*
+ * Index of the history by trigrams, used to find the lines which may
+ * contain a string without examining every line.  Each trigram of
+ * ASCII characters, folded to lower case, has a list of the numbers of
+ * the events containing it, stored as differences from the previous
+ * number so that most take a single byte.  The index is built the
+ * first time it is needed for a history large enough to make it
+ * worthwhile, then kept up to date as lines are added and removed.
+ * Lines are not removed from the lists when they leave the history;
+ * the index is discarded instead when too many of them have gone.
+ *
+ * The index can only ever say a line may match, so the caller always
+ * checks the text of the candidates.
+ */
+
+/* Don't index histories with fewer lines than this */
+#define HISTIDX_MIN	256
+
+struct histidxent {
+    int key;			/* the trigram, or 0 if slot unused */
+    int count;			/* number of events in the list */
+    int len, size;		/* bytes used and allocated in buf */
+    zlong last;			/* last event number in the list */
+    unsigned char *buf;		/* the list itself */
+};
+
+struct histidx {
+    struct histidxent *slots;	/* hash table of trigrams */
+    int nslots, nused;
+    Histent *ents;		/* entries, indexed by histnum - base */
+    zlong base;
+    int entsize;
+    zlong live, stale;		/* entries in, and removed from, the index */
+};
+
+static struct histidx *histindex;
+
+#define HISTIDX_FOLD(c)	((c) >= 'A' && (c) <= 'Z' ? (c) + 'a' - 'A' : (c))
+#define HISTIDX_KEY(s) \
+    ((HISTIDX_FOLD(STOUC((s)[0])) << 14) | \
+     (HISTIDX_FOLD(STOUC((s)[1])) << 7) | HISTIDX_FOLD(STOUC((s)[2])))
+#define HISTIDX_ASCII(s) \
+    (!((STOUC((s)[0]) | STOUC((s)[1]) | STOUC((s)[2])) & 0x80))
+
+static void
+histidx_free(struct histidx *hx)
+{
+    struct histidxent *ent;
+    int i;
+
+    if (!hx)
+	return;
+    for (i = 0, ent = hx->slots; i < hx->nslots; i++, ent++)
+	if (ent->buf)
+	    zfree(ent->buf, ent->size);
+    zfree(hx->slots, hx->nslots * sizeof(struct histidxent));
+    if (hx->ents)
+	zfree(hx->ents, hx->entsize * sizeof(Histent));
+    zfree(hx, sizeof(struct histidx));
+}
+
+/* Find the slot for a trigram, or the empty slot where it would go */
+
+static struct histidxent *
+histidx_slot(struct histidx *hx, int key)
+{
+    unsigned int i = ((unsigned int)key * 2654435761U) & (hx->nslots - 1);
+
+    while (hx->slots[i].key && hx->slots[i].key != key)
+	i = (i + 1) & (hx->nslots - 1);
+    return hx->slots + i;
+}
+
+static void
+histidx_grow(struct histidx *hx)
+{
+    struct histidxent *oslots = hx->slots, *ent;
+    int i, osize = hx->nslots;
+
+    hx->nslots *= 2;
+    hx->slots = (struct histidxent *)
+	zshcalloc(hx->nslots * sizeof(struct histidxent));
+    for (i = 0, ent = oslots; i < osize; i++, ent++)
+	if (ent->key)
+	    *histidx_slot(hx, ent->key) = *ent;
+    zfree(oslots, osize * sizeof(struct histidxent));
+}
+
+/* Record the entry for its event number; returns 0 if we can't */
+
+static int
+histidx_setent(struct histidx *hx, Histent he)
+{
+    zlong off = he->histnum - hx->base;
+
+    if (off < 0)
+	return 0;
+    if (off >= hx->entsize) {
+	int first, nsize;
+
+	/* Drop the events which have left the history from the front */
+	for (first = 0; first < hx->entsize && !hx->ents[first]; first++)
+	    ;
+	if (first) {
+	    memmove(hx->ents, hx->ents + first,
+		    (hx->entsize - first) * sizeof(Histent));
+	    memset(hx->ents + hx->entsize - first, 0, first * sizeof(Histent));
+	    hx->base += first;
+	    off -= first;
+	}
+	if (off >= hx->entsize) {
+	    for (nsize = hx->entsize ? hx->entsize : 1024; off >= nsize; )
+		nsize *= 2;
+	    hx->ents = (Histent *)zrealloc(hx->ents, nsize * sizeof(Histent));
+	    memset(hx->ents + hx->entsize, 0,
+		   (nsize - hx->entsize) * sizeof(Histent));
+	    hx->entsize = nsize;
+	}
+    }
+    if (!hx->ents[off])
+	hx->live++;
+    hx->ents[off] = he;
+    return 1;
+}
+
+/* Add the trigrams of an entry to the index; returns 0 on failure */
+
+static int
+histidx_addent(struct histidx *hx, Histent he)
+{
+    zlong num = he->histnum;
+    char *s;
+
+    if (!hx->ents && !hx->live)
+	hx->base = num;
+    if (!histidx_setent(hx, he))
+	return 0;
+    for (s = he->node.nam; s[0] && s[1] && s[2]; s++) {
+	struct histidxent *ent;
+	zlong delta;
+
+	if (!HISTIDX_ASCII(s))
+	    continue;
+	ent = histidx_slot(hx, HISTIDX_KEY(s));
+	if (!ent->key) {
+	    if (4 * (hx->nused + 1) > 3 * hx->nslots) {
+		histidx_grow(hx);
+		ent = histidx_slot(hx, HISTIDX_KEY(s));
+	    }
+	    ent->key = HISTIDX_KEY(s);
+	    hx->nused++;
+	} else if (ent->last == num)
+	    continue;
+	else if (ent->last > num)
+	    return 0;
+	if (ent->len + 10 > ent->size) {
+	    int nsize = ent->size ? 2 * ent->size : 16;
+	    ent->buf = (unsigned char *)zrealloc(ent->buf, nsize);
+	    ent->size = nsize;
+	}
+	for (delta = num - ent->last; delta >= 0x80; delta >>= 7)
+	    ent->buf[ent->len++] = (unsigned char)(delta | 0x80);
+	ent->buf[ent->len++] = (unsigned char)delta;
+	ent->last = num;
+	ent->count++;
+    }
+    return 1;
+}
+
+/* Index the whole history, if it's worth it */
+
+static struct histidx *
+histidx_build(void)
+{
+    struct histidx *hx;
+    Histent he;
+
+    if (!hist_ring || histlinect < HISTIDX_MIN)
+	return NULL;
+    hx = (struct histidx *)zshcalloc(sizeof(struct histidx));
+    hx->nslots = 4096;
+    hx->slots = (struct histidxent *)
+	zshcalloc(hx->nslots * sizeof(struct histidxent));
+    for (he = hist_ring->down; ; he = he->down) {
+	if (he != &curline && !histidx_addent(hx, he)) {
+	    histidx_free(hx);
+	    return NULL;
+	}
+	if (he == hist_ring)
+	    break;
+    }
+    return hx;
+}
+
+/* A new line has been added to the history */
+
+/**/
+void
+histidx_add(Histent he)
+{
+    if (histindex && !histidx_addent(histindex, he)) {
+	histidx_free(histindex);
+	histindex = NULL;
+    }
+}
+
+/* A line is leaving the history, or is about to be reused */
+
+/**/
+void
+histidx_remove(Histent he)
+{
+    struct histidx *hx = histindex;
+    zlong off;
+
+    if (!hx || (off = he->histnum - hx->base) < 0 || off >= hx->entsize ||
+	hx->ents[off] != he)
+	return;
+    hx->ents[off] = NULL;
+    hx->live--;
+    /* Start again when the lists are mostly dead wood */
+    if (++hx->stale > hx->live + HISTIDX_MIN) {
+	histidx_free(hx);
+	histindex = NULL;
+    }
+}
+
+/*
+ * Get the entry for an event number quickly from the index.
+ * Returns NULL if the event has gone.
+ */
+
+/**/
+mod_export Histent
+histidx_gethist(zlong ev)
+{
+    struct histidx *hx = histindex;
+    zlong off;
+
+    if (hx && ev != curhist && (off = ev - hx->base) >= 0 &&
+	off < hx->entsize)
+	return (hx->ents[off] && hx->ents[off]->histnum == ev) ?
+	    hx->ents[off] : NULL;
+    return gethistent(ev, GETHIST_EXACT);
+}
+
+/*
+ * Find the rarest trigram in the len bytes at str.  best is the
+ * rarest found so far, if any; it is returned if nothing in str is
+ * rarer.  *nonep is set if some trigram doesn't occur at all.
+ */
+
+static struct histidxent *
+histidx_rarest(struct histidx *hx, char *str, int len,
+	       struct histidxent *best, int *nonep)
+{
+    char *end = str + len;
+
+    for (; str + 3 <= end; str++) {
+	struct histidxent *ent;
+
+	if (!HISTIDX_ASCII(str))
+	    continue;
+	ent = histidx_slot(hx, HISTIDX_KEY(str));
+	if (!ent->key) {
+	    *nonep = 1;
+	    return NULL;
+	}
+	if (!best || ent->count < best->count)
+	    best = ent;
+    }
+    return best;
+}
+
+/* Return the event numbers in the list for ent in ascending order */
+
+static int
+histidx_decode(struct histidxent *ent, zlong **candsp)
+{
+    zlong *cands, num = 0;
+    unsigned char *p = ent->buf, *end = ent->buf + ent->len;
+    int n = 0;
+
+    cands = (zlong *)zalloc(ent->count * sizeof(zlong));
+    while (p < end) {
+	zlong delta = 0;
+	int shift = 0;
+
+	while (*p & 0x80) {
+	    delta |= (zlong)(*p++ & 0x7f) << shift;
+	    shift += 7;
+	}
+	delta |= (zlong)*p++ << shift;
+	cands[n++] = num += delta;
+    }
+    *candsp = cands;
+    return n;
+}
+
+/*
+ * Find the history lines which may contain the metafied string str,
+ * ignoring case.  On success, *candsp is set to an array allocated
+ * with zalloc() of the event numbers of the candidates, in ascending
+ * order, and its length is returned; this can be zero.  Lines being
+ * edited and the current line aren't in the index, so the caller must
+ * check those separately.  If the index can't help, for example
+ * because the string is too short, -1 is returned and every line
+ * needs examining.
+ */
+
+/**/
+mod_export int
+histidx_lookup(char *str, zlong **candsp)
+{
+    struct histidxent *best;
+    int none = 0;
+
+    if (!histindex && !(histindex = histidx_build()))
+	return -1;
+    best = histidx_rarest(histindex, str, strlen(str), NULL, &none);
+    if (none) {
+	*candsp = NULL;
+	return 0;
+    }
+    if (!best)
+	return -1;
+    return histidx_decode(best, candsp);
+}
+
+/*
+ * As histidx_lookup(), but for the lines which may match the pattern
+ * pat, which hasn't yet been tokenized.  Only runs of characters
+ * which any match must contain are used, so patterns with
+ * alternatives, exclusions and the like are not looked up.
+ */
+
+/**/
+mod_export int
+histidx_patlookup(char *pat, zlong **candsp)
+{
+    struct histidxent *best = NULL;
+    char *run, *buf, *p;
+    int none = 0;
+
+    if (!histindex && !(histindex = histidx_build()))
+	return -1;
+    run = buf = zhalloc(strlen(pat) + 1);
+    for (p = pat; ; p++) {
+	switch (*p) {
+	case '\\':
+	    if (p[1]) {
+		*run++ = *++p;
+		continue;
+	    }
+	    break;
+
+	case '[':
+	    /* skip the character class, and any [:name:] etc. in it */
+	    if (p[1] == '!' || p[1] == '^')
+		p++;
+	    if (p[1] == ']')
+		p++;
+	    while (p[1] && p[1] != ']') {
+		p++;
+		if (*p == '\\' && p[1])
+		    p++;
+		else if (*p == '[' &&
+			 (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+		    char *q;
+
+		    for (q = p + 2; *q && !(*q == p[1] && q[1] == ']'); q++)
+			;
+		    if (*q)
+			p = q + 1;
+		}
+	    }
+	    if (p[1])
+		p++;
+	    break;
+
+	case '<':
+	    while (p[1] && p[1] != '>')
+		p++;
+	    if (p[1])
+		p++;
+	    break;
+
+	case '#':
+	    /* the previous character may be repeated any number of times */
+	    if (run > buf)
+		run--;
+	    break;
+
+	case '(':
+	case ')':
+	case '|':
+	case '~':
+	case '^':
+	    return -1;
+
+	case '*':
+	case '?':
+	case '\0':
+	    break;
+
+	default:
+	    *run++ = *p;
+	    continue;
+	}
+	if (run - buf >= 3) {
+	    best = histidx_rarest(histindex, buf, run - buf, best, &none);
+	    if (none) {
+		*candsp = NULL;
+		return 0;
+	    }
+	}
+	run = buf;
+	if (!*p)
+	    break;
+    }
+    if (!best)
+	return -1;
+    return histidx_decode(best, candsp);
+}
+
+/*
+ * Return the first of the ncands event numbers in cands, which are in
+ * ascending order, that comes after ev in the direction dir, or -1.
+ */
+
+/**/
+mod_export zlong
+histidx_nextcand(zlong *cands, int ncands, zlong ev, int dir)
+{
+    int lo = 0, hi = ncands;
+
+    /* find the first candidate greater than ev */
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (cands[mid] <= ev)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (dir > 0)
+	return lo < ncands ? cands[lo] : -1;
+    /* step back over ev itself */
+    if (lo > 0 && cands[lo - 1] == ev)
+	lo--;
+    return lo > 0 ? cands[lo - 1] : -1;
+}
+
 static void
 putoldhistentryontop(short keep_going)
 {
@@ -1528,6 +1981,8 @@ hend(Eprog prog)
 	}
 	if (!(newflags & HIST_TMPSTORE))
 	    addhistnode(histtab, he->node.nam, he);
+	else
+	    histidx_add(he);
     }
     zfree(chline, hlinesz);
     zfree(chwords, chwordlen*sizeof(short));
@@ -3649,6 +4104,7 @@ pushhiststack(char *hf, zlong hs, zlong shs, int level)
     h->histlinect = histlinect;
     h->histsiz = histsiz;
     h->savehistsiz = savehistsiz;
+    h->histindex = histindex;
     h->locallevel = level;
 
     memset(&lasthist, 0, sizeof lasthist);
@@ -3659,6 +4115,7 @@ pushhiststack(char *hf, zlong hs, zlong shs, int level)
 	    unsetparam("HISTFILE");
     }
     hist_ring = NULL;
+    histindex = NULL;
     curhist = histlinect = 0;
     if (zleactive)
 	zleentry(ZLE_CMD_SET_HIST_LINE, curhist);
@@ -3687,6 +4144,7 @@ pophiststack(void)
 	unlinkcurline();
 
     deletehashtable(histtab);
+    histidx_free(histindex);
     zsfree(lasthist.text);
 
     h = &histsave_stack[--histsave_stack_pos];
@@ -3706,6 +4164,7 @@ pophiststack(void)
     histlinect = h->histlinect;
     histsiz = h->histsiz;
     savehistsiz = h->savehistsiz;
+    histindex = h->histindex;
 
     if (curline_in_ring)
 	linkcurline();
@@ -56,6 +56,8 @@ execfor(Estate state, int do_exec)
     char *name, *str, *cond = NULL, *advance = NULL;
     zlong val = 0;
     LinkList vars = NULL, args = NULL;
+    struct bracerange brange;
+    Bracerange range = NULL;
     int old_simple_pline = simple_pline;
 
     /* See comments in execwhile() */
@@ -95,7 +97,15 @@ execfor(Estate state, int do_exec)
 		return 0;
 	    }
 	    if (htok) {
-		execsubst(args);
+		/*
+		 * A lone {1..N} can be a very long list, so take the
+		 * values from it one at a time instead.
+		 */
+		if (isbracerange(args, &brange)) {
+		    range = &brange;
+		    args = NULL;
+		} else
+		    execsubst(args);
 		if (errflag) {
 		    state->pc = end;
 		    simple_pline = old_simple_pline;
@@ -111,7 +121,7 @@ execfor(Estate state, int do_exec)
 	}
     }
 
-    if (!args || empty(args))
+    if (!range && (!args || empty(args)))
 	lastval = 0;
 
     loops++;
@@ -152,7 +162,8 @@ execfor(Estate state, int do_exec)
 	    for (node = firstnode(vars); node; incnode(node))
 	    {
 		name = (char *)getdata(node);
-		if (!args || !(str = (char *) ugetnode(args)))
+		if (range ? !(str = nextbracerange(range)) :
+		    (!args || !(str = (char *) ugetnode(args))))
 		{
 		    if (count) { 
 			str = "";
@@ -172,7 +183,8 @@ execfor(Estate state, int do_exec)
 		break;
 	}
 	state->pc = loop;
-	execlist(state, 1, do_exec && args && empty(args));
+	execlist(state, 1, do_exec &&
+		 (range ? !range->count : args && empty(args)));
 	if (breaks) {
 	    breaks--;
 	    if (breaks || !contflag)
@@ -177,6 +177,8 @@ static const struct gsu_integer gid_gsu =
 { gidgetfn, gidsetfn, stdunsetfn };
 static const struct gsu_integer egid_gsu =
 { egidgetfn, egidsetfn, stdunsetfn };
+static const struct gsu_integer globcachesize_gsu =
+{ globcachesizegetfn, globcachesizesetfn, stdunsetfn };
 static const struct gsu_integer histsize_gsu =
 { histsizegetfn, histsizesetfn, stdunsetfn };
 static const struct gsu_integer random_gsu =
@@ -237,6 +239,8 @@ static const struct gsu_integer argc_gsu =
 { poundgetfn, nullintsetfn, stdunsetfn };
 static const struct gsu_array pipestatus_gsu =
 { pipestatgetfn, pipestatsetfn, stdunsetfn };
+static const struct gsu_array globcachestats_gsu =
+{ globcachestatsgetfn, nullarrsetfn, stdunsetfn };
 
 /* Nodes for special parameters for parameter hash table */
 
@@ -372,7 +376,8 @@ IPDEF9F("@", &pparams, NULL, PM_ARRAY|PM_SPECIAL|PM_DONTIMPORT|PM_READONLY),
  */
 {{NULL,NULL,0},BR(NULL),NULL_GSU,0,0,NULL,NULL,NULL,0},
 
-#define IPDEF10(A,B) {{NULL,A,PM_ARRAY|PM_SPECIAL},BR(NULL),GSU(B),10,0,NULL,NULL,NULL,0}
+#define IPDEF10F(A,B,F) {{NULL,A,F|PM_ARRAY|PM_SPECIAL},BR(NULL),GSU(B),10,0,NULL,NULL,NULL,0}
+#define IPDEF10(A,B) IPDEF10F(A,B,0)
 
 /*
  * The following parameters are not available in sh/ksh compatibility *
@@ -405,7 +410,9 @@ IPDEF9F("path", &path, "PATH", PM_RESTRICTED),
 
 /* These are known to zsh alone. */
 
+IPDEF1("GLOBCACHESIZE", globcachesize_gsu, 0),
 IPDEF10("pipestatus", pipestatus_gsu),
+IPDEF10F("globcachestats", globcachestats_gsu, PM_READONLY),
 
 {{NULL,NULL,0},BR(NULL),NULL_GSU,0,0,NULL,NULL,NULL,0},
 };
@@ -605,6 +612,161 @@ paramvalarr(HashTable ht, int flags)
     return paramvals;
 }
 
+/*
+ * Test if pm is an ordinary array whose value is kept in pm->u.arr
+ * and changed only by arrsetfn() and setarrvalue().  For these the
+ * length and allocated size of the value are remembered, which is
+ * valid as long as pm->alenarr is the current value.
+ */
+
+/**/
+static int
+plainarray(Param pm)
+{
+    if (pm->gsu.a != &stdarray_gsu ||
+	(pm->node.flags & (PM_UNIQUE|PM_TIED)) || pm->ename)
+	return 0;
+    if (pm->alenarr != pm->u.arr || !pm->u.arr) {
+	freearrindex(pm);
+	pm->alenarr = pm->u.arr;
+	pm->alen = pm->u.arr ? arrlen(pm->u.arr) : 0;
+	pm->asize = pm->u.arr ? pm->alen + 1 : 0;
+    }
+    return 1;
+}
+
+/*
+ * Forget what is remembered about the value of the array parameter
+ * pm; this must be called if the value is changed in place.
+ */
+
+/**/
+mod_export void
+arrvaluechanged(Param pm)
+{
+    pm->alenarr = NULL;
+    freearrindex(pm);
+}
+
+/* Number of elements in the value of the array parameter pm. */
+
+/**/
+int
+paramarrlen(Param pm)
+{
+    if (plainarray(pm))
+	return pm->alen;
+    return arrlen(pm->gsu.a->getfn(pm));
+}
+
+/*
+ * Number of elements in ss, the array value of v as returned by
+ * getvaluearr(v).
+ */
+
+/**/
+static int
+valuearrlen(Value v, char **ss)
+{
+    if (PM_TYPE(v->pm->node.flags) == PM_ARRAY && ss == v->pm->u.arr &&
+	plainarray(v->pm))
+	return v->pm->alen;
+    return arrlen(ss);
+}
+
+/*
+ * Hash index of the elements of an ordinary array, used for exact
+ * (i), (I), (r) and (R) subscript searches so that testing for
+ * membership of a long array doesn't have to look at every element.
+ * It is built the second time the same value is searched, so a
+ * single search costs no more than before, and is dropped as soon
+ * as the array changes.
+ */
+
+struct arrindexent {
+    unsigned hash;
+    int first, last;		/* positions + 1, 0 if slot unused */
+};
+
+struct arrindex {
+    char **arr;			/* the value indexed */
+    int searches;		/* searches of arr while not built */
+    int mask;			/* size of slots - 1 */
+    struct arrindexent *slots;	/* NULL until built */
+};
+
+/**/
+static void
+freearrindex(Param pm)
+{
+    Arrindex ai = pm->aindex;
+
+    if (ai) {
+	if (ai->slots)
+	    zfree(ai->slots, (ai->mask + 1) * sizeof(struct arrindexent));
+	zfree(ai, sizeof(*ai));
+	pm->aindex = NULL;
+    }
+}
+
+static struct arrindexent *
+arrindexslot(Arrindex ai, char *str, unsigned hash)
+{
+    struct arrindexent *e;
+    int i;
+
+    for (i = hash & ai->mask; ; i = (i + 1) & ai->mask) {
+	e = ai->slots + i;
+	if (!e->first ||
+	    (e->hash == hash && !strcmp(ai->arr[e->first - 1], str)))
+	    return e;
+    }
+}
+
+/*
+ * Look for an element equal to str in the plain array pm.  Returns
+ * its position counting from 1, the last such if down is set, 0 if
+ * there is none, or -1 if the index isn't built yet and the caller
+ * should search the elements itself.
+ */
+
+/**/
+static int
+arrindexsearch(Param pm, char *str, int down)
+{
+    Arrindex ai = pm->aindex;
+    struct arrindexent *e;
+
+    if (!ai || ai->arr != pm->u.arr) {
+	freearrindex(pm);
+	ai = pm->aindex = (Arrindex) zshcalloc(sizeof(*ai));
+	ai->arr = pm->u.arr;
+    }
+    if (!ai->slots) {
+	int size, i;
+
+	if (++ai->searches < 2)
+	    return -1;
+	for (size = 16; size < 2 * pm->alen; size <<= 1)
+	    ;
+	ai->mask = size - 1;
+	ai->slots = (struct arrindexent *)
+	    zshcalloc(size * sizeof(struct arrindexent));
+	for (i = 0; i < pm->alen && ai->arr[i]; i++) {
+	    unsigned hash = hasher(ai->arr[i]);
+
+	    e = arrindexslot(ai, ai->arr[i], hash);
+	    if (!e->first) {
+		e->hash = hash;
+		e->first = i + 1;
+	    }
+	    e->last = i + 1;
+	}
+    }
+    e = arrindexslot(ai, str, hasher(str));
+    return down ? e->last : e->first;
+}
+
 /* Return the full array (no indexing) referred to by a Value. *
  * The array value is cached for the lifetime of the Value.    */
 
@@ -1451,7 +1613,14 @@ getarg(char **str, int *inv, Value v, int a2, zlong *w,
 		ta = getarrvalue(v);
 	    if (!ta || !*ta)
 		return !down;
-	    len = arrlen(ta);
+	    len = valuearrlen(v, ta);
+	    if (!ishash && !hasbeg && num == 1 && pprog &&
+		(pprog->flags & PAT_PURES) && ta == v->pm->u.arr &&
+		plainarray(v->pm) &&
+		(r = arrindexsearch(v->pm,
+				    dupstrpfx((char *)pprog + pprog->startoff,
+					      pprog->patmlen), down)) >= 0)
+		return r ? r : (down ? 0 : len + 1);
 	    if (beg < 0)
 		beg += len;
 	    if (down) {
@@ -2024,9 +2193,11 @@ getstrvalue(Value v)
 	if (v->isarr)
 	    s = sepjoin(ss, NULL, 1);
 	else {
+	    int len = valuearrlen(v, ss);
+
 	    if (v->start < 0)
-		v->start += arrlen(ss);
-	    s = (v->start >= arrlen(ss) || v->start < 0) ?
+		v->start += len;
+	    s = (v->start >= len || v->start < 0) ?
 		(char *) hcalloc(1) : ss[v->start];
 	}
 	return s;
@@ -2204,7 +2375,8 @@ static char *nular[] = {"", NULL};
 mod_export char **
 getarrvalue(Value v)
 {
-    char **s;
+    char **s, **t;
+    int len, n;
 
     if (!v)
 	return arrdup(nular);
@@ -2221,19 +2393,29 @@ getarrvalue(Value v)
     s = getvaluearr(v);
     if (v->start == 0 && v->end == -1)
 	return s;
+    len = valuearrlen(v, s);
     if (v->start < 0)
-	v->start += arrlen(s);
+	v->start += len;
     if (v->end < 0)
-	v->end += arrlen(s) + 1;
-    if (v->start > arrlen(s) || v->start < 0)
+	v->end += len + 1;
+    if (v->start > len || v->start < 0) {
 	s = arrdup(nular);
-    else
-	s = arrdup(s + v->start);
-    if (v->end <= v->start)
-	s[0] = NULL;
-    else if (v->end - v->start <= arrlen(s))
-	s[v->end - v->start] = NULL;
-    return s;
+	if (v->end <= v->start)
+	    s[0] = NULL;
+	return s;
+    }
+    /*
+     * Like the whole array, the slice shares the element strings
+     * with the parameter; only the part of the vector needed is
+     * copied.
+     */
+    n = (v->end < len ? v->end : len) - v->start;
+    if (n < 0)
+	n = 0;
+    t = (char **) zhalloc((n + 1) * sizeof(char *));
+    memcpy(t, s + v->start, n * sizeof(char *));
+    t[n] = NULL;
+    return t;
 }
 
 /**/
@@ -2554,7 +2736,7 @@ setarrvalue(Value v, char **val)
 	char **const old = v->pm->gsu.a->getfn(v->pm);
 	char **new;
 	char **p, **q, **r; /* index variables */
-	const int pre_assignment_length = arrlen(old);
+	const int pre_assignment_length = paramarrlen(v->pm);
 	int post_assignment_length;
 	int i;
 
@@ -2578,6 +2760,46 @@ setarrvalue(Value v, char **val)
 	if (v->end < v->start)
 	    v->end = v->start;
 
+	if (plainarray(v->pm)) {
+	    /*
+	     * An ordinary array: splice the new elements into the
+	     * existing vector, keeping the strings outside the
+	     * replaced range and taking over those of val, rather
+	     * than copying every element.  The vector grows
+	     * geometrically, so appending or setting a single element
+	     * costs the same however long the array is.
+	     */
+	    const int lval = arrlen(val);
+	    const int rend = (v->end < pre_assignment_length ?
+			      v->end : pre_assignment_length);
+	    const int tail = pre_assignment_length - rend;
+	    char **arr = v->pm->u.arr;
+
+	    freearrindex(v->pm);
+	    for (i = v->start; i < rend; i++)
+		zsfree(arr[i]);
+	    post_assignment_length = v->start + lval + tail;
+	    if (post_assignment_length >= v->pm->asize) {
+		int nsize = post_assignment_length + 1;
+
+		if (arr)
+		    nsize += nsize / 2;
+		arr = (char **) zrealloc(arr, sizeof(char *) * nsize);
+		v->pm->u.arr = v->pm->alenarr = arr;
+		v->pm->asize = nsize;
+	    }
+	    if (tail)
+		memmove(arr + v->start + lval, arr + rend,
+			sizeof(char *) * tail);
+	    for (i = pre_assignment_length; i < v->start; i++)
+		arr[i] = ztrdup("");
+	    memcpy(arr + v->start, val, sizeof(char *) * lval);
+	    arr[post_assignment_length] = NULL;
+	    v->pm->alen = post_assignment_length;
+	    free(val);
+	    return;
+	}
+
 	post_assignment_length = v->start + arrlen(val);
 	if (v->end <= pre_assignment_length)
 	    post_assignment_length += pre_assignment_length - v->end + 1;
@@ -2928,7 +3150,7 @@ assignaparam(char *s, char **val, int flags)
     if (flags & ASSPM_AUGMENT) {
     	if (v->start == 0 && v->end == -1) {
 	    if (PM_TYPE(v->pm->node.flags) & PM_ARRAY) {
-	    	v->start = arrlen(v->pm->gsu.a->getfn(v->pm));
+	    	v->start = paramarrlen(v->pm);
 	    	v->end = v->start + 1;
 	    } else if (PM_TYPE(v->pm->node.flags) & PM_HASHED)
 	    	v->start = -1, v->end = 0;
@@ -2936,7 +3158,7 @@ assignaparam(char *s, char **val, int flags)
 	    if (v->end > 0)
 		v->start = v->end--;
 	    else if (PM_TYPE(v->pm->node.flags) & PM_ARRAY) {
-		v->end = arrlen(v->pm->gsu.a->getfn(v->pm)) + v->end;
+		v->end = paramarrlen(v->pm) + v->end;
 		v->start = v->end + 1;
 	    }
 	}
@@ -3342,6 +3564,7 @@ arrsetfn(Param pm, char **x)
     if (pm->node.flags & PM_UNIQUE)
 	uniqarray(x);
     pm->u.arr = x;
+    arrvaluechanged(pm);
     /* Arrays tied to colon-arrays may need to fix the environment */
     if (pm->ename && x)
 	arrfixenv(pm->ename, x);
@@ -3423,7 +3646,7 @@ arrhashsetfn(Param pm, char **val, int augment)
 /*
  * These functions are used as the set function for special parameters that
  * cannot be set by the user.  The set is incomplete as the only such
- * parameters are scalar and integer.
+ * parameters are scalar, integer and array.
  */
 
 /**/
@@ -3433,6 +3656,13 @@ nullstrsetfn(UNUSED(Param pm), char *x)
     zsfree(x);
 }
 
+/**/
+mod_export void
+nullarrsetfn(UNUSED(Param pm), char **x)
+{
+    freearray(x);
+}
+
 /**/
 mod_export void
 nullintsetfn(UNUSED(Param pm), UNUSED(zlong x))
@@ -4176,6 +4406,46 @@ argzerogetfn(UNUSED(Param pm))
     return argzero;
 }
 
+/* Function to get value for special parameter `GLOBCACHESIZE' */
+
+/**/
+zlong
+globcachesizegetfn(UNUSED(Param pm))
+{
+    return globcachesize;
+}
+
+/* Function to set value of special parameter `GLOBCACHESIZE' */
+
+/**/
+void
+globcachesizesetfn(UNUSED(Param pm), zlong v)
+{
+    if ((globcachesize = v) < 0)
+	globcachesize = 0;
+    trimglobcache();
+}
+
+/* Function to get value for special parameter `globcachestats' */
+
+/**/
+char **
+globcachestatsgetfn(UNUSED(Param pm))
+{
+    char **x = (char **) zhalloc(4 * sizeof(char *));
+    char buf[DIGBUFSIZE];
+
+    sprintf(buf, "%d", globcachecount());
+    x[0] = dupstring(buf);
+    convbase(buf, globcachehits, 10);
+    x[1] = dupstring(buf);
+    convbase(buf, globcachemisses, 10);
+    x[2] = dupstring(buf);
+    x[3] = NULL;
+
+    return x;
+}
+
 /* Function to get value for special parameter `HISTSIZE' */
 
 /**/
@@ -5118,6 +5388,7 @@ freeparamnode(HashNode hn)
      */
     if (delunset)
 	pm->gsu.s->unsetfn(pm, 1);
+    freearrindex(pm);
     zsfree(pm->node.nam);
     /* If this variable was tied by the user, ename was ztrdup'd */
     if (pm->node.flags & PM_TIED)
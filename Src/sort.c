@@ -113,13 +113,17 @@ eltpcmp(const void *a, const void *b)
 	bs += (laststarta - as);
 	as += (laststarta - as);
     }
+    if (ae->key && be->key)
+	cmp = strcmp(ae->key, be->key);
 #ifdef HAVE_STRCOLL
-    cmp = strcoll(as, bs);
+    else
+	cmp = strcoll(as, bs);
 #endif
     if (sortnumeric) {
 	for (; *as == *bs && *as; as++, bs++);
 #ifndef HAVE_STRCOLL
-	cmp = (int)STOUC(*as) - (int)STOUC(*bs);
+	if (!ae->key || !be->key)
+	    cmp = (int)STOUC(*as) - (int)STOUC(*bs);
 #endif
 	if (idigit(*as) || idigit(*bs)) {
 	    for (; as > ao && idigit(as[-1]); as--, bs--);
@@ -142,13 +146,78 @@ eltpcmp(const void *a, const void *b)
 	}
     }
 #ifndef HAVE_STRCOLL
-    else
+    else if (!ae->key || !be->key)
 	cmp = strcmp(as, bs);
 #endif
 
     return sortdir * cmp;
 }
 
+/* Below this many elements keysort() uses an insertion sort. */
+#define KEYSORT_SMALL 16
+
+/*
+ * Stable sort of n elements by the bytes of their collation keys,
+ * which are known to be the same up to depth.  This is a most
+ * significant byte first radix sort using tmp as workspace.  Only
+ * the smaller buckets are sorted recursively, so the depth of
+ * recursion is logarithmic however long the keys are.
+ */
+
+/**/
+static void
+keysort(SortElt *arr, SortElt *tmp, int n, int depth)
+{
+    int count[256], start[256], i, c, big;
+
+    while (n >= KEYSORT_SMALL) {
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+	    count[STOUC(arr[i]->key[depth])]++;
+	/* Keys that have ended come first, or last if reversed. */
+	for (i = 0, c = 0; c < 256; c++) {
+	    int b = (sortdir > 0) ? c : 255 - c;
+	    start[b] = i;
+	    i += count[b];
+	}
+	for (i = 0; i < n; i++)
+	    tmp[start[STOUC(arr[i]->key[depth])]++] = arr[i];
+	memcpy(arr, tmp, n * sizeof(SortElt));
+	/*
+	 * start[] now marks the end of each bucket.  Keys in
+	 * bucket 0 are identical and already in order.
+	 */
+	for (big = -1, c = 1; c < 256; c++) {
+	    if (count[c] < 2)
+		continue;
+	    if (big < 0 || count[c] > count[big]) {
+		if (big >= 0)
+		    keysort(arr + start[big] - count[big],
+			    tmp + start[big] - count[big], count[big],
+			    depth + 1);
+		big = c;
+	    } else
+		keysort(arr + start[c] - count[c], tmp + start[c] - count[c],
+			count[c], depth + 1);
+	}
+	if (big < 0)
+	    return;
+	arr += start[big] - count[big];
+	tmp += start[big] - count[big];
+	n = count[big];
+	depth++;
+    }
+    for (i = 1; i < n; i++) {
+	SortElt elt = arr[i];
+
+	for (c = i; c > 0 &&
+		 sortdir * strcmp(arr[c-1]->key + depth, elt->key + depth) > 0;
+	     c--)
+	    arr[c] = arr[c-1];
+	arr[c] = elt;
+    }
+}
+
 
 /*
  * Front-end to eltpcmp() to compare strings.
@@ -168,6 +237,7 @@ zstrcmp(const char *as, const char *bs, int sortflags)
     be.cmp = bs;
     ae.len = -1;
     be.len = -1;
+    ae.key = be.key = NULL;
 
     aeptr = &ae;
     beptr = &be;
@@ -184,6 +254,51 @@ zstrcmp(const char *as, const char *bs, int sortflags)
     return ret;
 }
 
+/*
+ * Return 1 if strings need passing through strxfrm() to get keys
+ * that strcmp() orders as zstrcmp() orders the strings, 0 if the
+ * collation order is plain byte order.
+ */
+
+/**/
+mod_export int
+sortkeyxfrm(void)
+{
+#ifdef HAVE_STRCOLL
+# ifdef USE_LOCALE
+    char *coll = setlocale(LC_COLLATE, NULL);
+    if (coll && (!strcmp(coll, "C") || !strcmp(coll, "POSIX")))
+	return 0;
+# endif
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Get the collation key for s, which is compared without regard
+ * to embedded nulls or numeric order.  xfrm is as returned by
+ * sortkeyxfrm().  The key is allocated on the heap unless it is
+ * simply s.
+ */
+
+/**/
+mod_export const char *
+sortkey(const char *s, int xfrm)
+{
+#ifdef HAVE_STRCOLL
+    if (xfrm) {
+	size_t klen = strxfrm(NULL, s, 0) + 1;
+	char *key = (char *)zhalloc(klen);
+
+	strxfrm(key, s, klen);
+	return key;
+    }
+#endif
+    return s;
+}
+
 
 /*
  * Sort an array of metafied strings.  Use an "or" of bit flags
@@ -207,7 +322,7 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
      */
     SortElt *sortptrarr, *sortptrarrptr;
     SortElt sortarr, sortarrptr;
-    int oldsortdir, oldsortnumeric, nsort;
+    int oldsortdir, oldsortnumeric, nsort, nokey = 0, xfrm;
 
     nsort = arrlen(array);
     if (nsort < 2)
@@ -215,6 +330,8 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
 
     pushheap();
 
+    xfrm = sortkeyxfrm();
+
     sortptrarr = (SortElt *) zhalloc(nsort * sizeof(SortElt));
     sortarr = (SortElt) zhalloc(nsort * sizeof(struct sortelt));
     for (arrptr = array, sortptrarrptr = sortptrarr, sortarrptr = sortarr;
@@ -358,6 +475,15 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
 	    sortarrptr->cmp = *arrptr;
 	    sortarrptr->len = needlen ? unmetalenp[arrptr-array] : -1;
 	}
+	/*
+	 * Work out the collation key once here rather than in every
+	 * comparison.  Embedded nulls are left to eltpcmp().
+	 */
+	if (sortarrptr->len != -1) {
+	    sortarrptr->key = NULL;
+	    nokey = 1;
+	} else
+	    sortarrptr->key = sortkey(sortarrptr->cmp, xfrm);
     }
     /*
      * We probably don't need to restore the following, but it's pretty cheap.
@@ -368,7 +494,11 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
     sortdir = (sortwhat & SORTIT_BACKWARDS) ? -1 : 1;
     sortnumeric = (sortwhat & SORTIT_NUMERICALLY) ? 1 : 0;
 
-    qsort(sortptrarr, nsort, sizeof(SortElt), eltpcmp);
+    if (sortnumeric || nokey)
+	qsort(sortptrarr, nsort, sizeof(SortElt), eltpcmp);
+    else
+	keysort(sortptrarr, (SortElt *) zhalloc(nsort * sizeof(SortElt)),
+		nsort, 0);
 
     sortnumeric = oldsortnumeric;
     sortdir = oldsortdir;
@@ -35,6 +35,16 @@
 /**/
 char nulstring[] = {Nularg, '\0'};
 
+/*
+ * Set by multsub() when the word it is expanding is nothing but a
+ * single nested ${...}.  The paramsubst() for that word claims it on
+ * entry and, if its result is an array that needs no further
+ * expansion, hands the array back here instead of splicing every
+ * element into the list for prefork() to rescan and multsub() to
+ * gather up again.
+ */
+static char ***subexp_result;
+
 /* Do substitutions before fork. These are:
  *  - Process substitution: <(...), >(...), =(...)
  *  - Parameter substitution
@@ -453,7 +463,7 @@ multsub(char **s, int pf_flags, char ***a, int *isarr, char *sep,
 	int *ms_flags)
 {
     int l;
-    char **r, **p, *x = *s;
+    char **r, **p, *x = *s, **subarr = NULL;
     local_list1(foo);
 
     if (pf_flags & PREFORK_SPLIT) {
@@ -528,13 +538,34 @@ multsub(char **s, int pf_flags, char ***a, int *isarr, char *sep,
 	}
     }
 
+    if ((pf_flags & PREFORK_SUBEXP) && a && (*x == String || *x == Qstring) &&
+	x[1] == Inbrace) {
+	char *e = x + 1;
+
+	if (!skipparens(Inbrace, Outbrace, &e) && !*e)
+	    subexp_result = &subarr;
+    }
     prefork(&foo, pf_flags, ms_flags);
+    subexp_result = NULL;
     if (errflag) {
 	if (isarr)
 	    *isarr = 0;
 	return 0;
     }
 
+    if (subarr) {
+	/* The array from paramsubst(); the list is empty. */
+	l = arrlen(subarr);
+	if (l > 1 || foo.list.flags & LF_ARRAY) {
+	    *a = subarr;
+	    *isarr = SCANPM_MATCHMANY;
+	    return 0;
+	}
+	*s = l ? *subarr : dupstring("");
+	if (isarr)
+	    *isarr = 0;
+	return !l;
+    }
     if ((l = countlinknodes(&foo)) > 1 || (foo.list.flags & LF_ARRAY && a)) {
 	p = r = hcalloc((l + 1) * sizeof(char*));
 	while (nonempty(&foo))
@@ -1751,7 +1782,14 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
      * nested (P) flags.
      */
     int fetch_needed;
+    /*
+     * Where to hand back an array result that needs no more expansion,
+     * see multsub().  Claimed now so that expansions nested inside
+     * this one don't see it.
+     */
+    char ***subres = subexp_result;
 
+    subexp_result = NULL;
     *s++ = '\0';
     /*
      * Nothing to do unless the character following the $ is
@@ -2308,6 +2346,9 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
 	    aspar = 0;
 	} else if (aspar)
 	    idbeg = val;
+	/* An array from multsub() is freshly made and ours to modify. */
+	if (isarr)
+	    copied = 1;
 	*s = sav;
 	/*
 	 * This tests for the second double quote in an expression
@@ -2548,7 +2589,7 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
 		 * necessary joining of arrays until this point
 		 * to avoid the multsub() horror.
 		 */
-		int tmplen = arrlen(v->pm->gsu.a->getfn(v->pm));
+		int tmplen = paramarrlen(v->pm);
 
 		if (v->start < 0)
 		    v->start += tmplen + ((v->flags & VALFLAG_INV) ? 1 : 0);
@@ -3821,6 +3862,32 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
 		strmetasort(aval, sortit, NULL);
 	    }
 	}
+	/*
+	 * A nested ${...} on its own: if no element has tokens that
+	 * prefork() would act on, pass the array straight back to
+	 * multsub(), dropping the empty elements prefork() would.
+	 */
+	if (subres && !plan9 && !eval && !globsubst && !prenum && !postnum &&
+	    aptr == (char *) getdata(n) && !*fstr &&
+	    !(ms_flags & (MULTSUB_WS_AT_START|MULTSUB_WS_AT_END))) {
+	    char **ap, **rp;
+
+	    for (ap = aval; *ap && !has_token(*ap); ap++)
+		;
+	    if (!*ap) {
+		rp = *subres = (char **) zhalloc((ap - aval + 1) *
+						 sizeof(char *));
+		for (ap = aval; *ap; ap++) {
+		    if (**ap)
+			*rp++ = copied ? *ap : dupstring(*ap);
+		    else if (qt && isarr != 2)
+			*rp++ = dupstring(nulstring);
+		}
+		*rp = NULL;
+		*str = aptr;
+		return n;
+	    }
+	}
 	if (plan9) {
 	    /* Handle RC_EXPAND_PARAM */
 	    LinkNode tn;
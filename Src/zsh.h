@@ -482,7 +482,9 @@ enum {
 /**************************/
 
 typedef struct alias     *Alias;
+typedef struct arrindex  *Arrindex;
 typedef struct asgment   *Asgment;
+typedef struct bracerange *Bracerange;
 typedef struct builtin   *Builtin;
 typedef struct cmdnam    *Cmdnam;
 typedef struct complist  *Complist;
@@ -1637,6 +1639,27 @@ struct imatchdata {
      * is anchored.  It goes on the heap.
      */
     LinkList repllist;
+    /*
+     * How far into ustr get_match_ret() has counted metafied
+     * characters, and how many it found, so that a run of matches
+     * moving along the string is converted in one pass.
+     */
+    int uoff, madd;
+};
+
+/*
+ * Values of a numeric brace expansion like {1..10..2}, produced in
+ * order by nextbracerange() in glob.c.
+ */
+struct bracerange {
+    /* Next value */
+    zlong val;
+    /* Difference between successive values */
+    zlong incr;
+    /* Number of values left */
+    zlong count;
+    /* Minimum width, padded with zeroes */
+    int minw;
 };
 
 /* Globbing flags: lower 8 bits gives approx count */
@@ -1743,6 +1766,9 @@ struct param {
     char *ename;		/* name of corresponding environment var */
     Param old;			/* old struct for use with local         */
     int level;			/* if (old != NULL), level of localness  */
+    char **alenarr;		/* u.arr for which alen and asize hold   */
+    int alen, asize;		/* elements and allocated slots of that  */
+    Arrindex aindex;		/* hash index of the elements of u.arr   */
 };
 
 /* structure stored in struct param's u.data by tied arrays */
@@ -2843,6 +2869,11 @@ struct sortelt {
      * The length is only needed if there are embededded nulls.
      */
     int len;
+    /*
+     * Collation key: a string whose byte order is the collation
+     * order of cmp, or NULL if there isn't one (embedded nulls).
+     */
+    const char *key;
 };
 
 typedef struct sortelt *SortElt;